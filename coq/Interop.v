@@ -8,7 +8,7 @@ Record ext_fn_rtl_spec :=
   { efr_name: string; efr_internal: bool }.
 
 Record ext_fn_sim_spec :=
-  { efs_name: string; efs_method: bool }.
+  { efs_name: string; efs_method: bool; efs_pure: bool }.
 
 Inductive empty_ext_fn_t :=.
 Definition empty_Sigma (fn: empty_ext_fn_t)
@@ -121,7 +121,14 @@ Section Packages.
           ‘method’ part indicates whether calls to a function need a pointer to
           the current simulator (this is useful if the function needs to mutate
           simulator internals).  The ‘name’ part is a C++ function name,
-          possibly prefixed with “template” if the function is templated.  *)
+          possibly prefixed with “template” if the function is templated.  The
+          ‘pure’ part indicates that a (non-method) function has no side
+          effects and that its result depends only on its argument (as for a
+          table lookup); calls to such functions are then compiled like
+          primitives, which lets the backend move, merge, or drop them.  In
+          particular, a pure function may be called speculatively (in both
+          branches of a conditional, or before the guard that protects it), so
+          it must be defined and cheap on every input of its argument type.  *)
       sp_ext_fn_specs: forall fn: ext_fn_t, ext_fn_sim_spec;
 
       (** [sp_prelude]: A piece of C++ code implementing the custom external
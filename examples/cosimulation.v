@@ -51,7 +51,8 @@ Module CoSimulation.
                      koika_module_name := "cosimulation" |};
 
        ip_sim := {| sp_ext_fn_specs _ := {| efs_name := "blackbox";
-                                          efs_method := false |};
+                                          efs_method := false;
+                                          efs_pure := false |};
                    sp_prelude := None |};
 
        ip_verilog := {| vp_ext_fn_specs _ := {| efr_name := "blackbox";
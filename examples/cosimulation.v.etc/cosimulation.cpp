@@ -29,10 +29,13 @@ struct extfuns {
   }
 };
 
-class simulator final : public module_cosimulation<extfuns> {
-  void strobe() const {
+class simulator final : public module_cosimulation<extfuns, simulator> {
+public:
+  void post_cycle() {
+#ifndef SIM_MINIMAL // Hooks also run in minimal builds, which have no iostreams
     std::cout << "# Cycle: " << meta.cycle_id << std::endl;
     snapshot().report();
+#endif
   }
 };
 
@@ -156,7 +156,7 @@ Definition package :=
      ip_sim :=
        {| sp_ext_fn_specs fn :=
             match fn with
-            | mod19 => {| efs_name := "mod19"; efs_method := false |}
+            | mod19 => {| efs_name := "mod19"; efs_method := false; efs_pure := true |}
             end;
           sp_prelude := Some "#include ""extfuns.hpp""" |};
 
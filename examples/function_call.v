@@ -83,7 +83,8 @@ Definition package :=
      ip_sim :=
        {| sp_ext_fn_specs fn :=
             {| efs_name := ext_fn_names fn;
-               efs_method := false |};
+               efs_method := false;
+               efs_pure := true |};
           sp_prelude := Some "#include ""extfuns.hpp""" |};
 
      ip_verilog := {| vp_ext_fn_specs fn :=
@@ -110,7 +110,8 @@ Definition package :=
 
      ip_sim := {| sp_ext_fn_specs fn :=
                    {| efs_name := ext_fn_names fn;
-                      efs_method := false |};
+                      efs_method := false;
+                      efs_pure := false |};
                  sp_prelude := Some cpp_extfuns |};
 
      ip_verilog := {| vp_ext_fn_specs fn :=
@@ -919,7 +919,8 @@ Module RV32Core (RVP: RVParams) (Multiplier: MultiplierInterface).
        efs_method := match fn with
                     | ext_finish => true
                     | _ => false
-                    end |}.
+                    end;
+       efs_pure := false |}.
 
   Definition rv_ext_fn_rtl_specs fn :=
     {| efr_name := show fn;
@@ -0,0 +1,300 @@
+/*! Memory-mapped devices for rv32 simulation with Cuttlesim !*/
+#ifndef _DEVICES_HPP
+#define _DEVICES_HPP
+
+#include <algorithm> // For std::upper_bound
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "elf.hpp"
+
+// The core decodes a handful of fixed MMIO addresses in hardware (see
+// ‘memoryBus’ in RVCore.v) and calls one extfun per device; every other data
+// access goes to ‘ext_mem_dmem’.  This file lets the driver attach devices to
+// the data bus at runtime instead: accesses that fall in RAM take a direct,
+// non-virtual path, and everything else is resolved by a binary search in a
+// table of address ranges.
+
+namespace devices {
+  using addr_t = std::uint32_t;
+  using word_t = std::uint32_t;
+
+  /// # Address map
+
+  // Keep in sync with RVCore.v and tests/mmio.c
+  static constexpr addr_t UART_ADDR = 0x40000000;
+  static constexpr addr_t LED_ADDR = 0x40000004;
+  static constexpr addr_t FINISH_ADDR = 0x40001000;
+  static constexpr addr_t HOST_ID_ADDR = 0x40001004;
+  static constexpr addr_t TIMER_ADDR = 0x40002000;
+  static constexpr addr_t HOST_DMA_ADDR = 0x40003000;
+
+  /// # Byte enables
+
+  // A request with byte_en = 0b0000 is a read; otherwise each bit of byte_en
+  // selects one byte of the written data.
+  static inline word_t byte_en_mask(unsigned byte_en) {
+    static constexpr word_t masks[16] = {
+      0x00000000, 0x000000ff, 0x0000ff00, 0x0000ffff,
+      0x00ff0000, 0x00ff00ff, 0x00ffff00, 0x00ffffff,
+      0xff000000, 0xff0000ff, 0xff00ff00, 0xff00ffff,
+      0xffff0000, 0xffff00ff, 0xffffff00, 0xffffffff
+    };
+    return masks[byte_en & 0xf];
+  }
+
+  /// # RAM
+
+  // Pages that have been written to are tracked, so that memories can be
+  // reset (or copied) without touching all of their contents.
+  struct ram {
+    static constexpr std::size_t page_words_log2 = 10; // 4KiB pages
+
+    std::size_t nwords;
+    std::unique_ptr<word_t[]> mem;
+    std::vector<bool> dirty;
+
+    bool contains(addr_t addr) const {
+      return (addr >> 2) < nwords;
+    }
+
+    void mark_dirty(addr_t addr, std::size_t nbytes) {
+      if (nbytes == 0)
+        return;
+      std::size_t last = std::min((addr + nbytes - 1) >> 2, nwords - 1);
+      for (std::size_t page = (addr >> 2) >> page_words_log2;
+           page <= last >> page_words_log2; page++)
+        dirty[page] = true;
+    }
+
+    // Returns the previous contents of the word at ‘addr’
+    word_t access(addr_t addr, unsigned byte_en, word_t data) {
+      word_t& cell = mem[addr >> 2];
+      word_t current = cell;
+      word_t mask = byte_en_mask(byte_en);
+      cell = (data & mask) | (current & ~mask);
+      if (byte_en)
+        dirty[(addr >> 2) >> page_words_log2] = true;
+      return current;
+    }
+
+    // Returns false if ‘elf_fpath’ is not a valid ELF file (segments loaded
+    // before the error was found are still marked dirty)
+    bool read_elf(const std::string& elf_fpath) {
+      std::vector<std::pair<std::uint32_t, std::uint32_t>> segments;
+      bool ok = elf_load(mem.get(), elf_fpath.c_str(), &segments);
+      for (auto& segment : segments)
+        mark_dirty(segment.first, segment.second);
+      return ok;
+    }
+
+    // Zero out all pages that have been written to
+    void clear() {
+      for (std::size_t page = 0; page < dirty.size(); page++) {
+        if (dirty[page]) {
+          std::size_t base = page << page_words_log2;
+          std::size_t len = std::min(nwords - base, std::size_t{1} << page_words_log2);
+          std::fill(&mem[base], &mem[base] + len, word_t{0});
+          dirty[page] = false;
+        }
+      }
+    }
+
+    // Copy the pages that have been written to in ‘other’ (a memory of the
+    // same size)
+    void copy_dirty_pages(const ram& other) {
+      for (std::size_t page = 0; page < dirty.size(); page++) {
+        if (other.dirty[page]) {
+          std::size_t base = page << page_words_log2;
+          std::size_t len = std::min(nwords - base, std::size_t{1} << page_words_log2);
+          std::copy(&other.mem[base], &other.mem[base] + len, &mem[base]);
+          dirty[page] = true;
+        }
+      }
+    }
+
+    // Use new … instead of make_unique to avoid 0-initialization (fresh pages
+    // from the OS are zeroed anyway, and untouched ones don't use any memory)
+    explicit ram(std::size_t nwords)
+      : nwords{nwords}, mem{new word_t[nwords]},
+        dirty(((nwords - 1) >> page_words_log2) + 1, false) {}
+  };
+
+  /// # Devices
+
+  struct device {
+    // ‘offset’ is relative to the base address at which the device is mapped
+    virtual word_t access(addr_t offset, unsigned byte_en, word_t data) = 0;
+    virtual ~device() = default;
+  };
+
+  struct uart final : public device {
+    FILE* input = stdin; // Reads return EOF if null
+
+    word_t access(addr_t /*offset*/, unsigned byte_en, word_t data) override {
+      if (byte_en) {
+        putchar(static_cast<char>(data));
+        return 0;
+      }
+      return static_cast<word_t>(input ? getc(input) : EOF);
+    }
+  };
+
+  struct led final : public device {
+    bool on = false;
+
+    word_t access(addr_t /*offset*/, unsigned byte_en, word_t data) override {
+      bool current = on;
+      if (byte_en) {
+        on = data & 1;
+        fprintf(stderr, on ? "☀" : "🌣");
+      }
+      return current;
+    }
+  };
+
+  // Writes record an exit code, which the driver then uses to stop the
+  // simulation (devices have no access to the simulator itself).
+  struct finisher final : public device {
+    bool requested = false;
+    int exit_code = 0;
+
+    word_t access(addr_t /*offset*/, unsigned byte_en, word_t data) override {
+      if (byte_en) {
+        exit_code = static_cast<int>(data & 0xff);
+        requested = true;
+        if (exit_code == 0) {
+          printf("  [0;32mPASS[0m\n");
+        } else {
+          printf("  [0;31mFAIL[0m (%d)\n", exit_code);
+        }
+      }
+      return 0;
+    }
+  };
+
+  struct host_id final : public device {
+    word_t id;
+
+    word_t access(addr_t /*offset*/, unsigned /*byte_en*/, word_t /*data*/) override {
+      return id;
+    }
+
+    explicit host_id(word_t id) : id{id} {}
+  };
+
+  // Read-only view of a 64-bit cycle counter (low word at offset 0, high
+  // word at offset 4).
+  struct timer final : public device {
+    const std::uint_fast64_t* source = nullptr;
+
+    word_t access(addr_t offset, unsigned /*byte_en*/, word_t /*data*/) override {
+      std::uint64_t now = source ? *source : 0;
+      return static_cast<word_t>(offset & 4 ? now >> 32 : now);
+    }
+  };
+
+  // Semihosting: bulk transfers between simulated RAM and the host's stdin
+  // and stdout.  Programs write a RAM address to ADDR and a byte count to LEN,
+  // then write a command to CMD; the whole transfer happens during that write,
+  // and RESULT then holds the number of bytes copied (or -1 on error).
+  struct host_dma final : public device {
+    enum reg : addr_t { ADDR = 0, LEN = 4, CMD = 8, RESULT = 12 };
+    enum cmd : word_t { CMD_READ = 1, CMD_WRITE = 2 };
+
+    ram& mem;
+    word_t addr, len, result;
+    FILE* input = stdin; // Reads transfer nothing if null
+
+    word_t transfer(word_t cmd) {
+      std::size_t mem_sz = mem.nwords * sizeof(word_t);
+      if (addr > mem_sz || len > mem_sz - addr)
+        return static_cast<word_t>(-1);
+
+      char* ptr = reinterpret_cast<char*>(mem.mem.get()) + addr;
+      switch (cmd) {
+      case CMD_READ:
+        mem.mark_dirty(addr, len);
+        return static_cast<word_t>(input ? fread(ptr, 1, len, input) : 0);
+      case CMD_WRITE:
+        return static_cast<word_t>(fwrite(ptr, 1, len, stdout));
+      default:
+        return static_cast<word_t>(-1);
+      }
+    }
+
+    word_t access(addr_t offset, unsigned byte_en, word_t data) override {
+      if (!byte_en) {
+        switch (offset) {
+        case ADDR: return addr;
+        case LEN: return len;
+        case RESULT: return result;
+        default: return 0;
+        }
+      }
+
+      switch (offset) {
+      case ADDR: addr = data; break;
+      case LEN: len = data; break;
+      case CMD: result = transfer(data); break;
+      default: break;
+      }
+      return 0;
+    }
+
+    explicit host_dma(ram& mem) : mem{mem}, addr{0}, len{0}, result{0} {}
+  };
+
+  /// # Bus
+
+  struct bus {
+    struct mapping {
+      addr_t base;
+      addr_t size;
+      device* dev;
+    };
+
+    ram& mem;
+    std::vector<mapping> mappings; // Sorted by base address
+    std::uint64_t ndevice_accesses;
+
+    void attach(addr_t base, addr_t size, device& dev) {
+      auto pos = std::upper_bound(mappings.begin(), mappings.end(), base,
+                                  [](addr_t addr, const mapping& m) { return addr < m.base; });
+      bool overlaps_prev = pos != mappings.begin() && base - (pos - 1)->base < (pos - 1)->size;
+      bool overlaps_next = pos != mappings.end() && pos->base - base < size;
+      if (mem.contains(base) || overlaps_prev || overlaps_next) {
+        std::cerr << "ERROR: overlapping device mapping at 0x" << std::hex << base << std::endl;
+        exit(1);
+      }
+      mappings.insert(pos, mapping{base, size, &dev});
+    }
+
+    word_t access(addr_t addr, unsigned byte_en, word_t data) {
+      if (__builtin_expect(mem.contains(addr), 1))
+        return mem.access(addr, byte_en, data);
+      return access_device(addr, byte_en, data);
+    }
+
+    word_t __attribute__((noinline)) access_device(addr_t addr, unsigned byte_en, word_t data) {
+      ndevice_accesses++;
+      auto pos = std::upper_bound(mappings.begin(), mappings.end(), addr,
+                                  [](addr_t addr, const mapping& m) { return addr < m.base; });
+      if (pos != mappings.begin() && addr - (pos - 1)->base < (pos - 1)->size) {
+        --pos;
+        return pos->dev->access(addr - pos->base, byte_en, data);
+      }
+      std::cerr << "WARNING: unmapped access at 0x" << std::hex << addr << std::dec << std::endl;
+      return 0;
+    }
+
+    explicit bus(ram& mem) : mem{mem}, mappings{}, ndevice_accesses{0} {}
+    bus(const bus&) = delete;
+  };
+}
+
+#endif // #ifndef _DEVICES_HPP
@@ -23,8 +23,14 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <utility>
+#include <vector>
 
-void __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename) {
+// If ‘segments’ is not null, the address and size of each loaded segment are
+// appended to it.  Returns false (after printing an error) if the file cannot
+// be read or is not a valid 32-bit ELF file.
+bool __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename,
+                                        std::vector<std::pair<uint32_t, uint32_t>>* segments = nullptr) {
   std::ifstream elf_file;
   char* elf_data;
   unsigned long long elf_size;
@@ -33,7 +39,7 @@ void __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename
 
   if (!elf_file) {
 	std::cerr << "ERROR: fail reading elf file" << std::endl;
-	exit(1);
+	return false;
   }
 
   // Get size of the elf
@@ -43,12 +49,12 @@ void __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename
 
   if (!elf_file) {
 	std::cerr << "ERROR: fail reading elf file" << std::endl;
-	exit(1);
+	return false;
   }
 
   if (elf_size < sizeof(Elf32_Ehdr)) {
 	std::cerr << "ERROR: the file is too small to be a valid elf" << std::endl;
-	exit(1);
+	return false;
   }
 
   elf_data = new char[elf_size];
@@ -62,7 +68,8 @@ void __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename
       || e_ident[EI_MAG2] != ELFMAG2
       || e_ident[EI_MAG3] != ELFMAG3) {
 	std::cerr << "ERROR: the file is not a valid elf file" << std::endl;
-	exit(1);
+	delete[] elf_data;
+	return false;
   }
 
   if (e_ident[EI_CLASS] == ELFCLASS32) {
@@ -71,7 +78,8 @@ void __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename
 	Elf32_Phdr *phdr = (Elf32_Phdr*) (elf_data + ehdr->e_phoff);
 	if (elf_size < ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr)) {
       std::cerr << "ERROR: file too small for expected number of program header tables" << std::endl;
-      exit(1);
+      delete[] elf_data;
+      return false;
 	}
 	// loop through program header tables
 	for (int i = 0 ; i < ehdr->e_phnum ; i++) {
@@ -80,17 +88,26 @@ void __attribute__((noinline)) elf_load(uint32_t* dmem, const char* elf_filename
       if ((phdr[i].p_type == PT_LOAD) && (phdr[i].p_memsz > 0)) {
 		if (phdr[i].p_memsz < phdr[i].p_filesz) {
           std::cerr << "ERROR: file size is larger than target memory size" << std::endl;
-          exit(1);
+          delete[] elf_data;
+          return false;
 		}
 		if ((phdr[i].p_filesz > 0) && (phdr[i].p_offset + phdr[i].p_filesz > elf_size)) {
           std::cerr << "ERROR: file section overflow" << std::endl;
+          delete[] elf_data;
+          return false;
 		}
 		// Set the corresponding section in IMem
 		memcpy(&dmem[phdr[i].p_paddr>>2], elf_data + phdr[i].p_offset, phdr[i].p_filesz);
+		if (segments)
+          segments->emplace_back(phdr[i].p_paddr, phdr[i].p_filesz);
       }
 	}
   } else {
     std::cerr << "ERROR: the file is not a 32-bit elf file" << std::endl;
-    exit(1);
+    delete[] elf_data;
+    return false;
   }
+
+  delete[] elf_data;
+  return true;
 }
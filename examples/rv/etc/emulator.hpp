@@ -0,0 +1,213 @@
+/*! Functional model of the rv32 core, used to fast-forward Cuttlesim !*/
+#ifndef _EMULATOR_HPP
+#define _EMULATOR_HPP
+
+#include <cstdint>
+
+#include "devices.hpp"
+
+#ifdef RV32E
+#define RV_NREGS 16
+#else
+#define RV_NREGS 32
+#endif
+
+// Everything that survives a pipeline flush: the PC of the next instruction,
+// the register file, and the retired instruction count.  Memory is shared
+// between the two models, so it is not part of this structure.
+struct arch_state {
+  std::uint32_t pc;
+  std::uint32_t x[RV_NREGS];
+  std::uint32_t instret;
+};
+
+// This interpreter follows RVCore.v rather than the RISC-V spec where the two
+// differ: illegal instructions jump to address 0 (and do not retire), SYSTEM
+// instructions are no-ops, register indices are truncated to log2(NREGS)
+// bits, and the RV32E core has no multiplier (MUL executes as ADD).
+template<typename dbus_t>
+struct emulator {
+  using word_t = devices::word_t;
+
+  devices::ram& imem;
+  dbus_t& dbus;
+  arch_state st;
+
+  enum opcode : word_t {
+    LOAD = 0x03, OP_IMM = 0x13, AUIPC = 0x17, STORE = 0x23, OP = 0x33,
+    LUI = 0x37, BRANCH = 0x63, JALR = 0x67, JAL = 0x6f, SYSTEM = 0x73
+  };
+
+  static word_t sext(word_t x, unsigned sz) {
+    return static_cast<word_t>(static_cast<std::int32_t>(x << (32 - sz)) >> (32 - sz));
+  }
+
+  static bool is_legal(word_t inst) {
+    word_t opcode = inst & 0x7f, funct3 = (inst >> 12) & 0x7, funct7 = inst >> 25;
+    word_t rd = (inst >> 7) & 0x1f, rs1 = (inst >> 15) & 0x1f, rs2 = (inst >> 20) & 0x1f;
+    switch (opcode) {
+    case LOAD:
+      return funct3 != 3 && funct3 < 6;
+    case OP_IMM:
+      if (funct3 == 1)
+        return funct7 == 0;
+      if (funct3 == 5)
+        return funct7 == 0 || funct7 == 0x20;
+      return true;
+    case STORE:
+      return funct3 < 3;
+    case OP:
+      if (funct3 == 0)
+        return funct7 == 0 || funct7 == 0x20 || funct7 == 1;
+      if (funct3 == 5)
+        return funct7 == 0 || funct7 == 0x20;
+      return funct7 == 0;
+    case BRANCH:
+      return funct3 != 2 && funct3 != 3;
+    case JALR:
+      return funct3 == 0;
+    case AUIPC: case LUI: case JAL:
+      return true;
+    case SYSTEM: {
+      word_t priv = (funct7 << 5) | rs2;
+      return funct3 == 0 && rd == 0 && rs1 == 0 &&
+        (priv == 0x000 || priv == 0x001 || priv == 0x302 || priv == 0x105);
+    }
+    default:
+      return false;
+    }
+  }
+
+  static word_t alu(word_t funct3, word_t funct7, word_t a, word_t b) {
+    bool inst_30 = funct7 & 0x20;
+    unsigned shamt = b & 0x1f;
+    switch (funct3) {
+    case 0: return inst_30 ? a - b : a + b;
+    case 1: return a << shamt;
+    case 2: return static_cast<std::int32_t>(a) < static_cast<std::int32_t>(b);
+    case 3: return a < b;
+    case 4: return a ^ b;
+    case 5: return inst_30 ? static_cast<word_t>(static_cast<std::int32_t>(a) >> shamt) : a >> shamt;
+    case 6: return a | b;
+    default: return a & b;
+    }
+  }
+
+  static bool taken(word_t funct3, word_t a, word_t b) {
+    auto sa = static_cast<std::int32_t>(a), sb = static_cast<std::int32_t>(b);
+    switch (funct3) {
+    case 0: return a == b;
+    case 1: return a != b;
+    case 4: return sa < sb;
+    case 5: return !(sa < sb);
+    case 6: return a < b;
+    default: return !(a < b);
+    }
+  }
+
+  // Execute one instruction; returns false if the PC is outside of imem.
+  bool step() {
+    word_t pc = st.pc;
+    if (!imem.contains(pc))
+      return false;
+
+    word_t inst = imem.mem[pc >> 2];
+    if (!is_legal(inst)) {
+      st.pc = 0;
+      return true;
+    }
+
+    word_t opcode = inst & 0x7f, funct3 = (inst >> 12) & 0x7, funct7 = inst >> 25;
+    word_t rd = (inst >> 7) & 0x1f;
+    word_t a = st.x[(inst >> 15) & (RV_NREGS - 1)];
+    word_t b = st.x[(inst >> 20) & (RV_NREGS - 1)];
+
+    word_t immI = sext(inst >> 20, 12);
+    word_t immS = sext(((inst >> 25) << 5) | rd, 12);
+    word_t immB = sext(((inst >> 31) << 12) | (((inst >> 7) & 1) << 11) |
+                       (((inst >> 25) & 0x3f) << 5) | (((inst >> 8) & 0xf) << 1), 13);
+    word_t immU = inst & 0xfffff000;
+    word_t immJ = sext(((inst >> 31) << 20) | (((inst >> 12) & 0xff) << 12) |
+                       (((inst >> 20) & 1) << 11) | (((inst >> 21) & 0x3ff) << 1), 21);
+
+    word_t next_pc = pc + 4, rd_val = 0;
+    bool writes_rd = true;
+
+    switch (opcode) {
+    case LUI:
+      rd_val = immU;
+      break;
+    case AUIPC:
+      rd_val = pc + immU;
+      break;
+    case JAL:
+      rd_val = pc + 4;
+      next_pc = pc + immJ;
+      break;
+    case JALR:
+      rd_val = pc + 4;
+      next_pc = (a + immI) & ~word_t{1};
+      break;
+    case BRANCH:
+      writes_rd = false;
+      if (taken(funct3, a, b))
+        next_pc = pc + immB;
+      break;
+    case LOAD: {
+      word_t addr = a + immI, shift = (addr & 3) * 8;
+      word_t data = dbus.access(addr & ~word_t{3}, 0b0000, 0) >> shift;
+      switch (funct3) {
+      case 0: rd_val = sext(data, 8); break;
+      case 1: rd_val = sext(data, 16); break;
+      case 4: rd_val = data & 0xff; break;
+      case 5: rd_val = data & 0xffff; break;
+      default: rd_val = data; break;
+      }
+      break;
+    }
+    case STORE: {
+      word_t addr = a + immS, offset = addr & 3;
+      unsigned byte_en = ((funct3 == 0 ? 0b0001 : funct3 == 1 ? 0b0011 : 0b1111) << offset) & 0xf;
+      writes_rd = false;
+      dbus.access(addr & ~word_t{3}, byte_en, b << (offset * 8));
+      break;
+    }
+    case OP_IMM:
+      rd_val = alu(funct3, funct3 == 0 ? 0 : funct7, a, immI);
+      break;
+    case OP:
+#ifndef RV32E
+      if (funct7 == 1) {
+        rd_val = a * b;
+        break;
+      }
+#endif
+      rd_val = alu(funct3, funct7, a, b);
+      break;
+    default: // SYSTEM
+      writes_rd = false;
+      break;
+    }
+
+    if (writes_rd && rd != 0)
+      st.x[rd & (RV_NREGS - 1)] = rd_val;
+    st.pc = next_pc;
+    st.instret++;
+    return true;
+  }
+
+  // Run at most ‘ninstrs’ instructions, stopping early when ‘halt’ becomes
+  // true (e.g. after a write to the finish device).  Returns the number of
+  // instructions executed.
+  std::uint64_t run(std::uint64_t ninstrs, const bool& halt) {
+    std::uint64_t n = 0;
+    while (n < ninstrs && !halt && step())
+      n++;
+    return n;
+  }
+
+  emulator(devices::ram& imem, dbus_t& dbus, const arch_state& st)
+    : imem{imem}, dbus{dbus}, st(st) {}
+};
+
+#endif // #ifndef _EMULATOR_HPP
@@ -1,79 +1,163 @@
 /*! C++ driver for rv32i simulation with Cuttlesim !*/
+#include <cstdlib>
 #include <iostream>
-#include <optional>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 #include "rv32.hpp"
-#include "elf.hpp"
+#include "devices.hpp"
+#include "emulator.hpp"
 #include "cuttlesim.hpp"
 
 #define DMEM_SIZE (static_cast<std::size_t>(1) << 25)
 
-struct bram {
-  std::unique_ptr<bits<32>[]> mem;
-  std::optional<struct_mem_req> last;
-
-  std::optional<struct_mem_resp> get(bool enable) {
-    if (!enable || !last.has_value())
-      return std::nullopt;
-
-    auto data = last->data;
-    auto addr = last->addr;
-    auto dEn = last->byte_en;
-    bits<32> current = bits<32>{0};
-    current = mem[addr.v >> 2];
-    mem[addr.v >> 2] =
-      ((dEn[2'0_d] ? data : current) & 0x32'000000ff_x) |
-      ((dEn[2'1_d] ? data : current) & 0x32'0000ff00_x) |
-      ((dEn[2'2_d] ? data : current) & 0x32'00ff0000_x) |
-      ((dEn[2'3_d] ? data : current) & 0x32'ff000000_x);
-
-    last.reset();
-    return std::optional<struct_mem_resp>{{
-        .byte_en = dEn, .addr = addr, .data = current
-      }};
-  }
-
-  bool put(std::optional<struct_mem_req> req) {
-    if (!req.has_value() || last.has_value())
-      return false;
+// Maximum number of cycles spent waiting for the pipeline to drain when
+// handing state back to the functional model
+#define DRAIN_LIMIT 10000
 
-    last = *req;
-    return true;
+#define RF_0_15(X)                                                      \
+  X(0, rf_x00_zero) X(1, rf_x01_ra) X(2, rf_x02_sp) X(3, rf_x03_gp)     \
+  X(4, rf_x04_tp) X(5, rf_x05_t0) X(6, rf_x06_t1) X(7, rf_x07_t2)       \
+  X(8, rf_x08_s0_fp) X(9, rf_x09_s1) X(10, rf_x10_a0) X(11, rf_x11_a1)  \
+  X(12, rf_x12_a2) X(13, rf_x13_a3) X(14, rf_x14_a4) X(15, rf_x15_a5)
+#define RF_16_31(X)                                                     \
+  X(16, rf_x16_a6) X(17, rf_x17_a7) X(18, rf_x18_s2) X(19, rf_x19_s3)   \
+  X(20, rf_x20_s4) X(21, rf_x21_s5) X(22, rf_x22_s6) X(23, rf_x23_s7)   \
+  X(24, rf_x24_s8) X(25, rf_x25_s9) X(26, rf_x26_s10) X(27, rf_x27_s11) \
+  X(28, rf_x28_t3) X(29, rf_x29_t4) X(30, rf_x30_t5) X(31, rf_x31_t6)
+
+#ifdef RV32E
+#define RF(X) RF_0_15(X)
+#else
+#define RF(X) RF_0_15(X) RF_16_31(X)
+#endif
+
+// A memory port that answers each request one cycle after accepting it, like
+// the BRAMs of the FPGA version.  ‘target’ is either a ‘devices::ram’ or a
+// ‘devices::bus’.
+template<typename target_t>
+struct mem_port {
+  target_t& target;
+  bool pending;
+  struct_mem_req last;
+  std::uint64_t nloads, nstores;
+
+  struct_mem_output getput(struct_mem_input req) {
+    struct_mem_output out{};
+
+    if (req.get_ready && pending) {
+      auto data = target.access(last.addr.v, last.byte_en.v, last.data.v);
+      out.get_valid = 1'1_b;
+      out.get_response = struct_mem_resp{
+        .byte_en = last.byte_en, .addr = last.addr, .data = bits<32>{data}
+      };
+      pending = false;
+    }
+
+    if (req.put_valid && !pending) {
+      last = req.put_request;
+      pending = true;
+      (last.byte_en.v ? nstores : nloads)++;
+      out.put_ready = 1'1_b;
+    }
+
+    return out;
   }
 
+  explicit mem_port(target_t& target)
+    : target{target}, pending{false}, last{}, nloads{0}, nstores{0} {}
+};
+
+// A core's connection to the shared data bus of a multi-hart SoC (see ‘soc’
+// below).  Requests are only recorded during the cycle; the SoC carries them
+// out after all cores have completed the cycle, which lets it simulate the
+// cores concurrently.
+struct hart_port {
+  struct device_write {
+    devices::addr_t addr;
+    unsigned byte_en;
+    devices::word_t data;
+  };
+
+  const devices::led& led;
+  bool pending, responded;
+  struct_mem_req last;
+  devices::word_t response;
+  std::vector<device_write> device_writes;
+
+  // Same protocol and latency as ‘mem_port’
   struct_mem_output getput(struct_mem_input req) {
-    std::optional<struct_mem_resp> get_response = get(bool(req.get_ready));
-    bool put_ready = put(req.put_valid ? std::optional<struct_mem_req>{req.put_request} : std::nullopt);
-    return struct_mem_output{
-      .get_valid = bits<1>{get_response.has_value()},
-      .put_ready = bits<1>{put_ready},
-      .get_response = get_response.value_or(struct_mem_resp{})
-    };
+    struct_mem_output out{};
+
+    if (req.get_ready && responded) {
+      out.get_valid = 1'1_b;
+      out.get_response = struct_mem_resp{
+        .byte_en = last.byte_en, .addr = last.addr, .data = bits<32>{response}
+      };
+      responded = false;
+    }
+
+    if (req.put_valid && !pending && !responded) {
+      last = req.put_request;
+      pending = true;
+      out.put_ready = 1'1_b;
+    }
+
+    return out;
   }
 
-  void read_elf(const std::string& elf_fpath) {
-    elf_load(reinterpret_cast<uint32_t*>(mem.get()), elf_fpath.c_str());
+  // Device writes are deferred too; reads are answered immediately, since
+  // they have no side effects in multi-hart mode (there is no UART input).
+  devices::word_t device_access(devices::addr_t addr, unsigned byte_en, devices::word_t data) {
+    if (byte_en)
+      device_writes.push_back(device_write{addr, byte_en, data});
+    if (addr == devices::LED_ADDR)
+      return led.on;
+    return static_cast<devices::word_t>(EOF);
   }
 
-  // Use new … instead of make_unique to avoid 0-initialization
-  bram() : mem{new bits<32>[DMEM_SIZE]}, last{} {}
+  explicit hart_port(const devices::led& led)
+    : led{led}, pending{false}, responded{false}, last{}, response{0}, device_writes{} {}
 };
 
 struct extfuns_t {
-  bram dmem, imem;
-  bits<1> led;
+  devices::ram imem, dmem;
+  devices::bus bus;
+
+  devices::uart uart;
+  devices::led led;
+  devices::finisher finisher;
+  devices::host_id host_id;
+  devices::timer timer;
+  devices::host_dma host_dma;
+
+  mem_port<devices::ram> imem_port;
+  mem_port<devices::bus> dmem_port;
+
+  // Set when this core is part of a multi-hart SoC; data and device accesses
+  // then go to the SoC's shared bus instead of ‘bus’.
+  hart_port* shared;
+
+  devices::word_t device_access(devices::addr_t addr, unsigned byte_en, devices::word_t data) {
+    if (shared)
+      return shared->device_access(addr, byte_en, data);
+    return bus.access(addr, byte_en, data);
+  }
 
   struct_mem_output ext_mem_dmem(struct_mem_input req) {
-    return dmem.getput(req);
+    if (shared)
+      return shared->getput(req);
+    return dmem_port.getput(req);
   }
 
   struct_mem_output ext_mem_imem(struct_mem_input req) {
-    return imem.getput(req);
+    return imem_port.getput(req);
   }
 
   bits<1> ext_uart_write(struct_maybe_bits_8 req) {
     if (req.valid) {
-      putchar(static_cast<char>(req.data.v));
+      device_access(devices::UART_ADDR, 0b1111, req.data.v);
     }
     return req.valid;
   }
@@ -82,83 +166,222 @@ struct extfuns_t {
     bool valid = req.v;
     return struct_maybe_bits_8 {
       .valid = bits<1>{valid},
-      .data = bits<8>{(bits_t<8>)(valid ? getchar() : 0)} };
+      .data = bits<8>{(bits_t<8>)(valid ? device_access(devices::UART_ADDR, 0b0000, 0) : 0)} };
   }
 
   bits<1> ext_led(struct_maybe_bits_1 req) {
-    bits<1> current = led;
-    if (req.valid) {
-      led = req.data;
-      fprintf(stderr, led.v ? "☀" : "🌣");
-    }
-    return current;
+    unsigned byte_en = req.valid ? 0b1111 : 0b0000;
+    return bits<1>{(bits_t<1>)(device_access(devices::LED_ADDR, byte_en, req.data.v) & 1)};
   }
 
+  // Each core of a multi-hart SoC has its own ‘host_id’ device
   enum_hostID ext_host_id(bits<1>) {
-    return enum_hostID::Cuttlesim;
+    return static_cast<enum_hostID>(bus.access(devices::HOST_ID_ADDR, 0b0000, 0));
   }
 
   template<typename simulator>
   bits<1> ext_finish(simulator& sim, struct_maybe_bits_8 req) {
     if (req.valid) {
-      bits<8> exitcode = req.data;
-      if (exitcode == 8'0_b) {
-        printf("  [0;32mPASS[0m\n");
-      } else {
-        printf("  [0;31mFAIL[0m (%d)\n", exitcode.v);
-      }
-      sim.finish(cuttlesim::exit_info_none, exitcode.v);
+      device_access(devices::FINISH_ADDR, 0b1111, req.data.v);
+    }
+    if (finisher.requested) {
+      sim.finish(cuttlesim::exit_info_none, finisher.exit_code);
     }
     return 1'0_b;
   }
 
-  extfuns_t() : dmem{}, imem{}, led{false} {}
+  // Return to the state of a freshly constructed ‘extfuns_t’
+  void reset() {
+    imem.clear();
+    dmem.clear();
+    bus.ndevice_accesses = 0;
+    led.on = false;
+    finisher.requested = false;
+    finisher.exit_code = 0;
+    host_dma.addr = host_dma.len = host_dma.result = 0;
+    imem_port.pending = dmem_port.pending = false;
+    imem_port.nloads = imem_port.nstores = 0;
+    dmem_port.nloads = dmem_port.nstores = 0;
+  }
+
+  extfuns_t() : imem{DMEM_SIZE}, dmem{DMEM_SIZE}, bus{dmem},
+                uart{}, led{}, finisher{},
+                host_id{static_cast<devices::word_t>(enum_hostID::Cuttlesim)},
+                timer{}, host_dma{dmem},
+                imem_port{imem}, dmem_port{bus}, shared{nullptr} {
+    bus.attach(devices::UART_ADDR, 4, uart);
+    bus.attach(devices::LED_ADDR, 4, led);
+    bus.attach(devices::FINISH_ADDR, 4, finisher);
+    bus.attach(devices::HOST_ID_ADDR, 4, host_id);
+    bus.attach(devices::TIMER_ADDR, 8, timer);
+    bus.attach(devices::HOST_DMA_ADDR, 16, host_dma);
+  }
+};
+
+#ifdef SIM_PERF_COUNTERS
+// Pipeline statistics, sampled at the end of each cycle.  A FIFO counts as
+// ‘empty’ in cycles that leave its consumer with nothing to do, and as
+// ‘blocked’ in cycles during which it held on to the same entry (its consumer
+// stalled).
+template<typename state_t>
+struct perf_counters {
+  struct fifo_counters {
+    std::uint64_t empty, blocked;
+
+    template<typename T>
+    void sample(const bits<1> valid, const T& data, bits<1>& last_valid, T& last_data) {
+      empty += !valid.v;
+      blocked += valid.v && last_valid.v && bool(data == last_data);
+      last_valid = valid;
+      last_data = data;
+    }
+
+    void report(std::ostream& os, const char* name) const {
+      os << "    \"" << name << "\": { \"empty\": " << empty
+         << ", \"blocked\": " << blocked << " }";
+    }
+  };
+
+  std::uint64_t cycles, instrs;
+  fifo_counters f2d, d2e, e2w;
+
+  // Only the fields that we need from the previous cycle
+  struct {
+    decltype(state_t::instr_count) instr_count;
+    decltype(state_t::f2d_valid0) f2d_valid0;
+    decltype(state_t::f2d_data0) f2d_data0;
+    decltype(state_t::d2e_valid0) d2e_valid0;
+    decltype(state_t::d2e_data0) d2e_data0;
+    decltype(state_t::e2w_valid0) e2w_valid0;
+    decltype(state_t::e2w_data0) e2w_data0;
+  } last;
+
+  void sample(const state_t& s) {
+    cycles++;
+    instrs += static_cast<std::uint32_t>(s.instr_count.v - last.instr_count.v);
+    last.instr_count = s.instr_count;
+    f2d.sample(s.f2d_valid0, s.f2d_data0, last.f2d_valid0, last.f2d_data0);
+    d2e.sample(s.d2e_valid0, s.d2e_data0, last.d2e_valid0, last.d2e_data0);
+    e2w.sample(s.e2w_valid0, s.e2w_data0, last.e2w_valid0, last.e2w_data0);
+  }
+
+  // Forget the previous cycle (e.g. after the state is replaced wholesale)
+  void resync(const state_t& s) {
+    last.instr_count = s.instr_count;
+    last.f2d_valid0 = last.d2e_valid0 = last.e2w_valid0 = 1'0_b;
+  }
+
+  void report(std::ostream& os, const extfuns_t& extfuns) const {
+    os << "{" << std::endl;
+    os << "  \"cycles\": " << cycles << "," << std::endl;
+    os << "  \"instructions\": " << instrs << "," << std::endl;
+    os << "  \"ipc\": " << (cycles ? double(instrs) / double(cycles) : 0.0) << "," << std::endl;
+    os << "  \"fifos\": {" << std::endl;
+    f2d.report(os, "f2d");
+    os << "," << std::endl;
+    d2e.report(os, "d2e");
+    os << "," << std::endl;
+    e2w.report(os, "e2w");
+    os << std::endl << "  }," << std::endl;
+    os << "  \"memory\": {" << std::endl;
+    os << "    \"imem_loads\": " << extfuns.imem_port.nloads << "," << std::endl;
+    os << "    \"dmem_loads\": " << extfuns.dmem_port.nloads << "," << std::endl;
+    os << "    \"dmem_stores\": " << extfuns.dmem_port.nstores << "," << std::endl;
+    os << "    \"mmio_accesses\": " << extfuns.bus.ndevice_accesses << std::endl;
+    os << "  }" << std::endl;
+    os << "}" << std::endl;
+  }
+
+  explicit perf_counters(const state_t& s) : cycles{0}, instrs{0}, f2d{}, d2e{}, e2w{}, last{} {
+    resync(s);
+  }
 };
+#endif
+
+class rv_core final : public module_rv32<extfuns_t, rv_core> {
+#ifdef SIM_PERF_COUNTERS
+  perf_counters<state_t> perf{Log.state};
+#endif
+
+  arch_state read_arch_state(std::uint32_t pc) const {
+    arch_state arch{};
+    arch.pc = pc;
+    arch.instret = Log.state.instr_count.v;
+#define READ_RF(idx, reg) arch.x[idx] = Log.state.reg.v;
+    RF(READ_RF)
+#undef READ_RF
+    return arch;
+  }
+
+  // The pipeline holds no partially-executed instructions when e2w is empty
+  // (everything older has been written back) and d2e holds a correct-path
+  // instruction (its PC is the architectural PC).
+  bool drained() const {
+    return !Log.state.e2w_valid0.v && Log.state.d2e_valid0.v &&
+      Log.state.d2e_data0.epoch.v == Log.state.epoch.v;
+  }
+
+public:
+  // Restart the pipeline from architectural state ‘arch’
+  void load_arch_state(const arch_state& arch) {
+    state_t state = initial_state();
+    state.cycle_count = Log.state.cycle_count;
+    state.instr_count = bits<32>{arch.instret};
+    state.pc = bits<32>{arch.pc};
+#define WRITE_RF(idx, reg) state.reg = bits<32>{arch.x[idx]};
+    RF(WRITE_RF)
+#undef WRITE_RF
+    set_state(state);
+    extfuns.imem_port.pending = extfuns.dmem_port.pending = false;
+#ifdef SIM_PERF_COUNTERS
+    perf.resync(state);
+#endif
+  }
+
+  // Run cycles until the pipeline is drained, then extract its architectural
+  // state.  Returns false if this takes more than ‘max_cycles’ cycles.
+  bool save_arch_state(arch_state& arch, std::uint_fast64_t max_cycles = DRAIN_LIMIT) {
+    for (std::uint_fast64_t n = 0; !drained(); n++) {
+      if (n == max_cycles || meta.finished)
+        return false;
+      cycle();
+    }
+    arch = read_arch_state(Log.state.d2e_data0.pc.v);
+    return true;
+  }
+
+  // Run the next ‘ninstrs’ instructions in the functional model, starting
+  // from ‘arch’, then resume cycle-accurate simulation.
+  std::uint64_t fast_forward(arch_state arch, std::uint64_t ninstrs) {
+    emulator<devices::bus> emu{extfuns.imem, extfuns.bus, arch};
+    std::uint64_t ran = emu.run(ninstrs, extfuns.finisher.requested);
+    if (extfuns.finisher.requested)
+      finish(cuttlesim::exit_info_none, extfuns.finisher.exit_code);
+    load_arch_state(emu.st);
+    return ran;
+  }
+
+  std::uint64_t fast_forward(std::uint64_t ninstrs) {
+    arch_state arch{};
+    if (!save_arch_state(arch))
+      return 0;
+    return fast_forward(arch, ninstrs);
+  }
 
-class rv_core final : public module_rv32<extfuns_t> {
-  void strobe() const {
+  // Hooks (see cuttlesim::default_hooks)
+  void post_cycle() {
+#ifdef SIM_PERF_COUNTERS
+    perf.sample(Log.state);
+#endif
 #if defined(SIM_STROBE) && !defined(SIM_MINIMAL)
-    std::cout << "# " << ncycles << std::endl;
+    std::cout << "# " << meta.cycle_id << std::endl;
     std::cout << "pc = " << Log.state.pc << std::endl;
     std::cout << "epoch = " << Log.state.epoch << std::endl;
-    std::cout << "inst_count = " << Log.state.inst_count << std::endl;
+    std::cout << "instr_count = " << Log.state.instr_count << std::endl;
     std::cout << "rf = {" << std::endl;
-    std::cout << "  " <<
-      "[01] (ra) = " << Log.state.rf_x01_ra << "; " <<
-      "[02] (sp) = " << Log.state.rf_x02_sp << "; " <<
-      "[03] (gp) = " << Log.state.rf_x03_gp << "; " <<
-      "[04] (tp) = " << Log.state.rf_x04_tp << std::endl;
-    std::cout << "  [05-07] (t0-t2)     = " <<
-      Log.state.rf_x05_t0 << "; " <<
-      Log.state.rf_x06_t1 << "; " <<
-      Log.state.rf_x07_t2 << std::endl;
-    std::cout << "  [08-09] (s0_fp, s1) = " <<
-      Log.state.rf_x08_s0_fp << "; " <<
-      Log.state.rf_x09_s1 << std::endl;
-    std::cout << "  [10-17] (a0-a7)     = " <<
-      Log.state.rf_x10_a0 << "; " <<
-      Log.state.rf_x11_a1 << "; " <<
-      Log.state.rf_x12_a2 << "; " <<
-      Log.state.rf_x13_a3 << "; " <<
-      Log.state.rf_x14_a4 << "; " <<
-      Log.state.rf_x15_a5 << "; " <<
-      Log.state.rf_x16_a6 << "; " <<
-      Log.state.rf_x17_a7 << std::endl;
-    std::cout << "  [18-27] (s2-s11)    = " << Log.state.rf_x18_s2 << "; " <<
-      Log.state.rf_x19_s3 << "; " <<
-      Log.state.rf_x20_s4 << "; " <<
-      Log.state.rf_x21_s5 << "; " <<
-      Log.state.rf_x22_s6 << "; " <<
-      Log.state.rf_x23_s7 << "; " <<
-      Log.state.rf_x24_s8 << "; " <<
-      Log.state.rf_x25_s9 << "; " <<
-      Log.state.rf_x26_s10 << "; " <<
-      Log.state.rf_x27_s11 << std::endl;
-    std::cout << "  [28-31] (t3-t6)     = " <<
-      Log.state.rf_x28_t3 << "; " <<
-      Log.state.rf_x29_t4 << "; " <<
-      Log.state.rf_x30_t5 << "; " <<
-      Log.state.rf_x31_t6 << std::endl;
+#define PRINT_RF(idx, reg) std::cout << "  " #reg " = " << Log.state.reg << std::endl;
+    RF(PRINT_RF)
+#undef PRINT_RF
     std::cout << "}" << std::endl;
     std::cout <<
       "toIMem = { valid0 = " << Log.state.toIMem_valid0
@@ -183,12 +406,196 @@ class rv_core final : public module_rv32<extfuns_t> {
 #endif
   }
 
+  // Load a program, then skip its first ‘ninstrs’ instructions (boot code,
+  // setup, etc.) using the functional model.  Returns false if the program
+  // cannot be loaded.
+  bool load_program(const std::string& elf_fpath, std::uint64_t ninstrs) {
+    if (!extfuns.imem.read_elf(elf_fpath))
+      return false;
+    extfuns.dmem.copy_dirty_pages(extfuns.imem);
+    if (ninstrs > 0) {
+      fast_forward(read_arch_state(Log.state.pc.v), ninstrs);
+    }
+    return true;
+  }
+
+  // Return to the initial state, reusing the already-allocated memories
+  void reset() {
+    set_state(initial_state());
+    meta = cuttlesim::sim_metadata{};
+    extfuns.reset();
+#ifdef SIM_STOP_ON_LOOP
+    loops = cuttlesim::loop_detector{};
+#endif
+#ifdef SIM_PERF_COUNTERS
+    perf = perf_counters<state_t>{Log.state};
+#endif
+  }
+
+#ifndef SIM_MINIMAL
+  // Server mode: run jobs read from ‘jobs’, one per line (‘elf_file [ncycles
+  // [fast_forward]]’), one after the other in this model.  Test suites with
+  // many small programs spend most of their time starting processes and
+  // allocating memories otherwise.  Each job's output is followed by a line
+  // ‘#done elf_file exit_code ncycles’ on stdout (‘exit_code’ is ‘timeout’ if
+  // the program did not finish, and ‘error’ if the job line is malformed or the
+  // program cannot be loaded).  With SIM_PERF_COUNTERS, each job's statistics
+  // are printed to stderr before that line.
+  int serve(std::istream& jobs) {
+    // Jobs arrive on stdin, so programs can't read from it
+    extfuns.uart.input = extfuns.host_dma.input = nullptr;
+
+    auto parse = [](const std::string& str, std::uint64_t& n) {
+      char* end = nullptr;
+      n = std::strtoull(str.c_str(), &end, 10);
+      return !str.empty() && *end == '\0';
+    };
+
+    std::string line;
+    while (std::getline(jobs, line)) {
+      std::istringstream job(line);
+      std::string elf_fpath;
+      std::string ncycles = "-1", ninstrs = "0";
+      if (!(job >> elf_fpath))
+        continue;
+      job >> ncycles >> ninstrs;
+
+      std::uint64_t max_cycles, skipped;
+      if (!parse(ncycles, max_cycles) || !parse(ninstrs, skipped)) {
+        std::cout << "#done " << elf_fpath << " error" << std::endl;
+        continue;
+      }
+
+      reset();
+      if (!load_program(elf_fpath, skipped)) {
+        std::cout << "#done " << elf_fpath << " error" << std::endl;
+        continue;
+      }
+      run(max_cycles);
+#ifdef SIM_PERF_COUNTERS
+      perf.report(std::cerr, extfuns);
+      perf = perf_counters<state_t>{Log.state}; // Reported already
+#endif
+
+      fflush(stdout);
+      std::cout << "#done " << elf_fpath << " ";
+      if (meta.finished)
+        std::cout << meta.exit_code;
+      else
+        std::cout << "timeout";
+      std::cout << " " << meta.cycle_id << std::endl;
+    }
+    return 0;
+  }
+#endif
+
+#ifdef SIM_PARALLEL
+  // Join a multi-hart SoC as hart ‘hart_id’ of ‘nharts’.  Only the program's
+  // instructions are loaded into this core's memory; its data lives in the
+  // SoC's shared memory.
+  void attach(hart_port& port, std::size_t hart_id, std::size_t nharts, const std::string& elf_fpath) {
+    extfuns.shared = &port;
+    extfuns.host_id.id = static_cast<devices::word_t>(enum_hostID::Cuttlesim) |
+      static_cast<devices::word_t>(hart_id << 1 | (nharts - 1) << 4); // See tests/mmio.c
+    extfuns.uart.input = extfuns.host_dma.input = nullptr;
+    if (!extfuns.imem.read_elf(elf_fpath))
+      exit(1);
+  }
+#endif
+
+  rv_core() : module_rv32{} {
+    extfuns.timer.source = &meta.cycle_id;
+  }
+
+  explicit rv_core(const std::string& elf_fpath) : rv_core{} {
+    // Skip the first $RV_FAST_FORWARD instructions
+    char* ninstrs = std::getenv("RV_FAST_FORWARD");
+    if (!load_program(elf_fpath, ninstrs ? std::stoull(ninstrs) : 0))
+      exit(1);
+  }
+
+#ifdef SIM_PERF_COUNTERS
+  ~rv_core() {
+    if (perf.cycles > 0) // Server mode reports each job separately
+      perf.report(std::cerr, extfuns);
+  }
+#endif
+};
+
+#ifdef SIM_PARALLEL
+// A multi-hart SoC: each core fetches instructions from a private copy of the
+// program, and all cores share one data memory and one set of devices.  In
+// each cycle, the cores are first simulated concurrently; then their data
+// requests and device writes are carried out one core at a time, starting
+// with a different core in each cycle (so the order is deterministic and
+// fair).  There are no caches, so memory is trivially coherent.
+class soc {
+  devices::ram dmem;
+  devices::bus bus;
+
+  devices::uart uart;
+  devices::led led;
+  devices::finisher finisher;
+  devices::timer timer;
+  devices::host_dma host_dma;
+
+  std::uint_fast64_t cycle_id;
+  std::vector<hart_port> ports;
+  std::vector<std::unique_ptr<rv_core>> cores;
+  cuttlesim::cluster_pool pool;
+
+  void arbitrate() {
+    std::size_t nharts = cores.size();
+    for (std::size_t pos = 0; pos < nharts; pos++) {
+      hart_port& port = ports[(cycle_id + pos) % nharts];
+      if (port.pending) {
+        port.response = bus.access(port.last.addr.v, port.last.byte_en.v, port.last.data.v);
+        port.pending = false;
+        port.responded = true;
+      }
+      for (auto& write : port.device_writes)
+        bus.access(write.addr, write.byte_en, write.data);
+      port.device_writes.clear();
+    }
+  }
+
 public:
-  explicit rv_core(const std::string& elf_fpath) : module_rv32{} {
-    extfuns.imem.read_elf(elf_fpath);
-    extfuns.dmem.read_elf(elf_fpath);
+  static constexpr std::size_t max_harts = 8; // See tests/mmio.c
+
+  // Returns the program's exit code, or -1 if it did not finish
+  int run(std::uint_fast64_t ncycles) {
+    for (std::uint_fast64_t cid = 0; cid < ncycles && !finisher.requested; cid++) {
+      cycle_id++;
+      pool.step(this, [](void* sim, std::size_t hart) {
+        static_cast<soc*>(sim)->cores[hart]->cycle();
+      });
+      arbitrate();
+    }
+    return finisher.requested ? finisher.exit_code : -1;
+  }
+
+  soc(std::size_t nharts, const std::string& elf_fpath)
+    : dmem{DMEM_SIZE}, bus{dmem}, uart{}, led{}, finisher{}, timer{}, host_dma{dmem},
+      cycle_id{0}, ports{}, cores{}, pool{nharts} {
+    uart.input = host_dma.input = nullptr;
+    timer.source = &cycle_id;
+    bus.attach(devices::UART_ADDR, 4, uart);
+    bus.attach(devices::LED_ADDR, 4, led);
+    bus.attach(devices::FINISH_ADDR, 4, finisher);
+    bus.attach(devices::TIMER_ADDR, 8, timer);
+    bus.attach(devices::HOST_DMA_ADDR, 16, host_dma);
+    if (!dmem.read_elf(elf_fpath))
+      exit(1);
+
+    ports.reserve(nharts); // Cores keep pointers to their ports
+    for (std::size_t hart = 0; hart < nharts; hart++) {
+      ports.emplace_back(led);
+      cores.emplace_back(new rv_core{});
+      cores.back()->attach(ports.back(), hart, nharts, elf_fpath);
+    }
   }
 };
+#endif
 
 #ifdef SIM_MINIMAL
 template rv_core::snapshot_t cuttlesim::init_and_run<rv_core>(unsigned long long, std::string&);
@@ -196,11 +603,28 @@ template rv_core::snapshot_t cuttlesim::init_and_run<rv_core>(unsigned long long
 int main(int argc, char** argv) {
   if (argc <= 1) {
     std::cerr << "Usage: ./rv_core elf_file [ncycles [vcd_path [vcd_period]]]" << std::endl;
+    std::cerr << "       ./rv_core --server < jobs" << std::endl;
+#ifdef SIM_PARALLEL
+    std::cerr << "       ./rv_core --harts nharts elf_file [ncycles]" << std::endl;
+#endif
     return 1;
   }
 
   setbuf(stdout, NULL);
   std::ios_base::sync_with_stdio(false);
+  if (std::string(argv[1]) == "--server")
+    return rv_core{}.serve(std::cin);
+#ifdef SIM_PARALLEL
+  if (std::string(argv[1]) == "--harts" && argc > 3) {
+    std::size_t nharts = std::stoul(argv[2]);
+    if (nharts == 0 || nharts > soc::max_harts) {
+      std::cerr << "Unsupported number of harts: " << nharts << std::endl;
+      return 1;
+    }
+    std::uint_fast64_t ncycles = argc > 4 ? std::stoull(argv[4]) : -1;
+    return soc{nharts, argv[3]}.run(ncycles);
+  }
+#endif
   cuttlesim::main<rv_core>(argc - 1, argv + 1, argv[1]);
 }
 #endif
@@ -0,0 +1,59 @@
+#include <stdbool.h>
+#include "../mmio.h"
+
+// Each hart sums the primes in its share of [2, LIMIT), then hart 0 collects
+// the partial sums.  rv32i has no atomics, so harts synchronize through flags
+// that only one hart writes.  With a single hart, hart 0 does all the work.
+
+#define LIMIT 2000
+#define EXPECTED 277050 // Sum of the primes below LIMIT
+#define MAX_HARTS 8
+
+typedef unsigned int uint;
+
+static volatile uint partial[MAX_HARTS];
+static volatile bool done[MAX_HARTS];
+
+uint rem(uint n, uint m) {
+  while (n >= m) {
+    n = n - m;
+  }
+  return n;
+}
+
+bool is_prime(uint n) {
+  for (uint m = 2; m * m <= n; m++) {
+    if (rem(n, m) == 0)
+      return false;
+  }
+  return true;
+}
+
+int main() {
+  uint id = hart_id(), n = nharts();
+
+  uint sum = 0;
+  for (uint k = 2 + id; k < LIMIT; k += n) {
+    if (is_prime(k))
+      sum += k;
+  }
+  partial[id] = sum;
+  done[id] = true;
+
+  if (id != 0) {
+    // Returning would call exit and stop all harts
+    for (;;);
+  }
+
+  uint total = 0;
+  for (uint h = 0; h < n; h++) {
+    while (!done[h]);
+    total += partial[h];
+  }
+
+  putchars("  ");
+  putchar('0' + n);
+  putchars(" hart(s)");
+  putln();
+  return total != EXPECTED;
+}
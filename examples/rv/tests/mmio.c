@@ -5,6 +5,14 @@ int host_is_fpga() {
   return 0;
 }
 
+int hart_id() {
+  return 0;
+}
+
+int nharts() {
+  return 1;
+}
+
 int led = 0;
 
 int getled() {
@@ -16,12 +24,33 @@ int putled(int on) {
   return on;
 }
 
+int host_read(void* buf, int len) {
+  return fread(buf, 1, len, stdin);
+}
+
+int host_write(const void* buf, int len) {
+  return fwrite(buf, 1, len, stdout);
+}
+
 #else
 
 static int* const UART_ADDR    = (int*)0x40000000;
 static int* const LED_ADDR     = (int*)0x40000004;
 static int* const STOP_ADDR    = (int*)0x40001000;
 static int* const HOST_ID_ADDR = (int*)0x40001004;
+static int* const HOST_DMA_ADDR = (int*)0x40003000;
+
+typedef enum {
+  HOST_DMA_ADDR_REG = 0,
+  HOST_DMA_LEN_REG = 1,
+  HOST_DMA_CMD_REG = 2,
+  HOST_DMA_RESULT_REG = 3
+} hostDMAReg;
+
+typedef enum {
+  HOST_DMA_READ = 1,
+  HOST_DMA_WRITE = 2
+} hostDMACmd;
 
 typedef enum {
   FPGA = 128,
@@ -34,6 +63,17 @@ int host_is_fpga() {
   return *HOST_ID_ADDR & FPGA;
 }
 
+// Cuttlesim's multi-hart driver reports the current hart in bits 1-3 of the
+// host ID, and the number of harts minus one in bits 4-6 (these bits are 0 on
+// other hosts).  Keep in sync with init.S.
+int hart_id() {
+  return (*HOST_ID_ADDR >> 1) & 7;
+}
+
+int nharts() {
+  return ((*HOST_ID_ADDR >> 4) & 7) + 1;
+}
+
 int getchar() {
   return 0;
 }
@@ -56,6 +96,24 @@ int putled(int on) {
   *LED_ADDR = on;
   return on;
 }
+
+static int host_dma(hostDMACmd cmd, const void* buf, int len) {
+  // Other hosts map these addresses to plain memory
+  if ((*HOST_ID_ADDR & (FPGA | VERILATOR)) != CUTTLESIM)
+    return -1;
+  HOST_DMA_ADDR[HOST_DMA_ADDR_REG] = (int)buf;
+  HOST_DMA_ADDR[HOST_DMA_LEN_REG] = len;
+  HOST_DMA_ADDR[HOST_DMA_CMD_REG] = cmd;
+  return HOST_DMA_ADDR[HOST_DMA_RESULT_REG];
+}
+
+int host_read(void* buf, int len) {
+  return host_dma(HOST_DMA_READ, buf, len);
+}
+
+int host_write(const void* buf, int len) {
+  return host_dma(HOST_DMA_WRITE, buf, len);
+}
 #endif
 
 void putchars(const char* str) {
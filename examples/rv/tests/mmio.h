@@ -11,6 +11,15 @@ int putled(int on);
 
 int host_is_fpga();
 
+// Multi-hart simulation (Cuttlesim only; other hosts have a single hart)
+int hart_id();
+int nharts();
+
+// Bulk transfers from the host's stdin and to its stdout (Cuttlesim only;
+// other hosts return -1)
+int host_read(void* buf, int len);
+int host_write(const void* buf, int len);
+
 void wait(long long int ncycles);
 void pause();
 #endif
@@ -2,13 +2,15 @@
 
 struct extfuns {};
 
-class simulator final : public module_save_restore<extfuns> {
-  void strobe() const {
+class simulator final : public module_save_restore<extfuns, simulator> {
+public:
+  void post_cycle() {
+#ifndef SIM_MINIMAL // Hooks also run in minimal builds, which have no iostreams
     std::cout << "# Cycle: " << meta.cycle_id << std::endl;
     snapshot().report();
+#endif
   }
 
-public:
   void save(std::string fname) {
     std::ofstream vcd(fname);
     state_t::vcd_header(vcd);
@@ -120,7 +120,7 @@ Module UART.
                      koika_scheduler := uart;
                      koika_module_name := "uart" |};
 
-       ip_sim := {| sp_ext_fn_specs fn := {| efs_name := show fn; efs_method := false |};
+       ip_sim := {| sp_ext_fn_specs fn := {| efs_name := show fn; efs_method := false; efs_pure := false |};
                    sp_prelude := None |};
 
        ip_verilog := {| vp_ext_fn_specs := ext_fn_specs |} |}.
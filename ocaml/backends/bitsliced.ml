@@ -0,0 +1,217 @@
+(*! Bit-sliced C++ backend (64 copies of a circuit simulated in parallel) !*)
+open Common
+open Cuttlebone
+open Cuttlebone.Graphs
+open Printf
+
+(* This backend prints the lowered circuits that the Verilog backend uses as a
+   single straight-line C++ function.  Nodes are printed in post-order, so each
+   one is computed once per cycle after all of its inputs (the result is
+   levelized and free of branches); all operations are on bit-sliced vectors
+   (see resources/bitsliced.hpp), so each run of that function simulates one
+   cycle of 64 independent copies of the design. *)
+
+let bitsliced_hpp_fname = "bitsliced.hpp"
+
+let unsupported fmt =
+  ksprintf (fun msg -> failwith (sprintf "Bit-sliced backend: %s" msg)) fmt
+
+let reg_name (r: reg_signature) =
+  Cpp.Mangling.mangle_name r.reg_name
+
+let fn_name (f: ffi_signature) =
+  Cpp.Mangling.mangle_name f.ffi_name
+
+let sp_vec_type sz =
+  sprintf "bitsliced::vec<%d>" sz
+
+(* MSB first, as expected by bitsliced::constant *)
+let sp_bitstring (bs: bits_value) =
+  String.concat "" (List.rev_map (fun b -> if b then "1" else "0") (Array.to_list bs))
+
+let sp_const (bs: bits_value) =
+  sprintf "bitsliced::constant<%d>(\"%s\")" (Array.length bs) (sp_bitstring bs)
+
+let sp_comparison signed (cmp: Extr.bits_comparison) =
+  sprintf "%s%s" (if signed then "s" else "u")
+    (match cmp with CLt -> "lt" | CGt -> "gt" | CLe -> "le" | CGe -> "ge")
+
+let sp_unop (fn: Extr.PrimTyped.fbits1) a =
+  let open Extr.PrimTyped in
+  match fn with
+  | Not _ -> sprintf "bitsliced::bnot(%s)" a
+  | Repeat (_, times) -> sprintf "bitsliced::repeat<%d>(%s)" times a
+  | Slice (_, offset, width) -> sprintf "bitsliced::slice<%d, %d>(%s)" offset width a
+  | SExt _ | ZExtL _ | ZExtR _ | Lowered _ -> Rtl.unlowered ()
+
+let sp_binop (fn: Extr.PrimTyped.fbits2) a1 a2 =
+  let open Extr.PrimTyped in
+  let call name = sprintf "bitsliced::%s(%s, %s)" name a1 a2 in
+  match fn with
+  | Sel _ -> call "sel"
+  | IndexedSlice (_, width) -> sprintf "bitsliced::islice<%d>(%s, %s)" width a1 a2
+  | And _ -> call "band"
+  | Or _ -> call "bor"
+  | Xor _ -> call "bxor"
+  | Lsl _ -> call "lsl"
+  | Lsr _ -> call "lsr"
+  | Asr _ -> call "asr"
+  | Concat _ -> call "concat"
+  | Plus _ -> call "add"
+  | Minus _ -> call "sub"
+  | Mul _ -> call "mul"
+  | EqBits (_, false) -> call "eq"
+  | EqBits (_, true) -> call "neq"
+  | Compare (signed, cmp, _) -> call (sp_comparison signed cmp)
+  | SliceSubst _ -> Rtl.unlowered ()
+
+type env = {
+    buf: Buffer.t;
+    names: (int, string) Hashtbl.t;
+    ext_funcalls: (string, ffi_signature) Hashtbl.t
+  }
+
+(* Print the definitions of [c] and of all its (not-yet-printed) inputs, and
+   return the name of the C++ variable holding the value of [c]. *)
+let rec p_circuit env (c: circuit) =
+  match Hashtbl.find_opt env.names c.tag with
+  | Some name -> name
+  | None ->
+     let name =
+       match c.node with
+       | CAnnot (_, _, c') -> p_circuit env c'
+       | node ->
+          let expr = sp_node env node in
+          let name = sprintf "n%d" c.tag in
+          bprintf env.buf "const auto %s = %s;\n" name expr;
+          name in
+     Hashtbl.replace env.names c.tag name;
+     name
+and sp_node env (node: circuit') =
+  match node with
+  | CMux (_, s, c1, c2) ->
+     let s = p_circuit env s in
+     let c1 = p_circuit env c1 in
+     let c2 = p_circuit env c2 in
+     sprintf "bitsliced::mux(%s, %s, %s)" s c1 c2
+  | CConst bs -> sp_const bs
+  | CReadRegister r ->
+     (* Copied, since registers are only updated at the end of the cycle *)
+     sprintf "state.%s" (reg_name r)
+  | CUnop (fn, c) ->
+     sp_unop fn (p_circuit env c)
+  | CBinop (fn, c1, c2) ->
+     let c1 = p_circuit env c1 in
+     let c2 = p_circuit env c2 in
+     sp_binop fn c1 c2
+  | CExternal { f; arg; _ } ->
+     let arg = p_circuit env arg in
+     Hashtbl.replace env.ext_funcalls f.ffi_name f;
+     sprintf "extfuns.%s(%s)" (fn_name f) arg
+  | CBundle (name, _) ->
+     unsupported "external rules are not supported (rule %s)" name
+  | CBundleRef (_, c, _) ->
+     p_circuit env c
+  | CAnnot (_, _, c) ->
+     p_circuit env c
+
+let p_model buf classname env { graph_roots; _ } =
+  let p fmt = bprintf buf (fmt ^^ "\n") in
+  let regs = List.map (fun root -> root.root_reg) graph_roots in
+  let reg_sz r = typ_sz (reg_type r) in
+
+  let cpp_define = sprintf "%s_HPP" (String.uppercase_ascii classname) in
+  p "#ifndef %s" cpp_define;
+  p "#define %s" cpp_define;
+  p "";
+  p "#include \"%s\"" bitsliced_hpp_fname;
+  p "";
+  p "template<typename extfuns_t>";
+  p "class %s {" classname;
+  p "public:";
+
+  p "struct state_t {";
+  List.iter (fun r -> p "%s %s;" (sp_vec_type (reg_sz r)) (reg_name r)) regs;
+  p "";
+  p "void dump(std::ostream& os, std::size_t lane) const {";
+  List.iter (fun r ->
+      p "os << \"%s = \";" r.reg_name;
+      p "bitsliced::print_lane(os, %s, lane);" (reg_name r);
+      p "os << std::endl;") regs;
+  p "}";
+  p "};";
+  p "";
+
+  p "std::uint_fast64_t cycle_id;";
+  p "state_t state;";
+  p "extfuns_t extfuns;";
+  p "";
+
+  p "static state_t initial_state() {";
+  p "state_t init{};";
+  List.iter (fun r ->
+      p "init.%s = %s;" (reg_name r) (sp_const (Util.bits_of_value r.reg_init))) regs;
+  p "return init;";
+  p "}";
+  p "";
+
+  p "void cycle() {";
+  let next = List.map (fun root -> root.root_reg, p_circuit env root.root_circuit) graph_roots in
+  Buffer.add_buffer buf env.buf;
+  List.iter (fun (r, name) -> p "state.%s = %s;" (reg_name r) name) next;
+  p "cycle_id++;";
+  p "}";
+  p "";
+
+  p "%s& run(std::uint_fast64_t ncycles) {" classname;
+  p "for (std::uint_fast64_t cid = 0; cid < ncycles; cid++)";
+  p "cycle();";
+  p "return *this;";
+  p "}";
+  p "";
+
+  p "explicit %s(const state_t init = initial_state())" classname;
+  p ": cycle_id{0}, state(init), extfuns{} {}";
+  p "};";
+  p "";
+  p "#endif"
+
+let p_extfuns buf ext_funcalls =
+  let p fmt = bprintf buf (fmt ^^ "\n") in
+  if Hashtbl.length ext_funcalls = 0 then
+    p "struct extfuns {};"
+  else begin
+      p "class extfuns {";
+      p "public:";
+      p "// External functions should be implemented here; each call receives and";
+      p "// returns one value per lane (use bitsliced::random for random stimulus).";
+      let fns = List.of_seq (Hashtbl.to_seq_values ext_funcalls) in
+      List.iter (fun f ->
+          p "// %s %s(const %s& arg);"
+            (sp_vec_type (typ_sz f.ffi_rettype)) (fn_name f)
+            (sp_vec_type (typ_sz f.ffi_argtype)))
+        (List.sort compare fns);
+      p "};"
+    end
+
+let main target_dpath (modname: string) (c: circuit_graph) =
+  let classname = Cpp.Mangling.mangle_name ~prefix:"bitsliced" modname in
+  let env = { buf = Buffer.create 4096;
+              names = Hashtbl.create 256;
+              ext_funcalls = Hashtbl.create 8 } in
+  let hpp = Buffer.create 4096 in
+  let extfuns = Buffer.create 256 in
+  p_model hpp classname env c;
+  p_extfuns extfuns env.ext_funcalls;
+  let markers =
+    [("__CUTTLEC_MODULE_NAME__", modname);
+     ("__CUTTLEC_BITSLICED_CLASS__", classname);
+     ("__CUTTLEC_EXTFUNS__", Buffer.contents extfuns)] in
+  let cpp = Buffer.create 4096 in
+  Buffer.add_string cpp (Common.replace_strings Resources.bitsliced_cpp markers);
+
+  let fpath_noext = Filename.concat target_dpath (modname ^ ".bitsliced") in
+  with_output_to_file (Filename.concat target_dpath bitsliced_hpp_fname)
+    output_string Resources.bitsliced_hpp;
+  Cpp.write_formatted fpath_noext ".hpp" hpp;
+  Cpp.write_formatted fpath_noext ".cpp" cpp
@@ -18,6 +18,19 @@ let add_line_pragmas = false
 let use_dynamic_logs = false
 let use_offsets_in_dynamic_log = false
 
+(* Conditionals with more operations than this in either branch are compiled to
+   if statements even when computing both branches would be safe *)
+let max_select_ops = 8
+
+(* Switches whose arms are all constants are compiled to lookup tables if their
+   discriminand has at most this many bits *)
+let max_table_bits = 8
+
+(* Shared internal functions are memoized (when compiling with SIM_MEMOIZE) if
+   they are pure, take at most 64 bits of arguments, and have at least this many
+   AST nodes *)
+let min_memoized_fn_size = 32
+
 type ('pos_t, 'var_t, 'fn_name_t, 'rule_name_t, 'reg_t, 'ext_fn_t) cpp_rule_t = {
     rl_external: bool;
     rl_name: 'rule_name_t;
@@ -41,7 +54,7 @@ type ('pos_t, 'var_t, 'fn_name_t, 'rule_name_t, 'reg_t, 'ext_fn_t) cpp_input_t =
     cpp_registers: 'reg_t array;
     cpp_register_sigs: 'reg_t -> reg_signature;
     cpp_register_kinds: 'reg_t -> Extr.register_kind;
-    cpp_ext_sigs: 'ext_fn_t -> (ffi_signature * [`Function | `Method]);
+    cpp_ext_sigs: 'ext_fn_t -> (ffi_signature * [`Function | `PureFunction | `Method]);
 
     cpp_extfuns: string option;
   }
@@ -254,7 +267,7 @@ let assert_bits (tau: typ) =
   | Bits_t sz -> sz
   | _ -> failwith "Expecting bits, not struct or enum"
 
-let cpp_ext_funcall f (kind: [`Function | `Method]) a =
+let cpp_ext_funcall f (kind: [`Function | `PureFunction | `Method]) a =
   (* The current implementation of external functions requires the client to
      pass a class implementing those functions as a template argument.  An
      other approach would have made external functions virtual methods, but
@@ -691,9 +704,125 @@ let compile (type pos_t var_t fn_name_t rule_name_t reg_t ext_fn_t)
   let iter_all_registers f =
     Array.iter f all_register_sigs in
 
+  (* Registers are identified by their position when hashing states *)
+  let register_ids =
+    let ids = Hashtbl.create (Array.length all_register_sigs) in
+    Array.iteri (fun i r -> Hashtbl.add ids r.reg_name i) all_register_sigs;
+    Hashtbl.find ids in
+
   let reg_sig_w_kind r =
     (hpp.cpp_register_kinds r, hpp.cpp_register_sigs r) in
 
+  (* Calls to pure external functions have no effects, so they can be moved,
+     merged, or dropped like primitives *)
+  let pure_ext_fn fn =
+    snd (hpp.cpp_ext_sigs fn) = `PureFunction in
+
+  let rec collect_ext_calls acc (a: (_, var_t, fn_name_t, reg_t, ext_fn_t) Extr.action) =
+    match a with
+    | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> acc
+    | Extr.Assign (_, _, _, _, a) | Extr.Write (_, _, _, a)
+    | Extr.Unop (_, _, a) | Extr.APos (_, _, _, a) ->
+       collect_ext_calls acc a
+    | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+    | Extr.Bind (_, _, _, _, a1, a2) ->
+       collect_ext_calls (collect_ext_calls acc a1) a2
+    | Extr.If (_, _, cond, tbr, fbr) ->
+       collect_ext_calls (collect_ext_calls (collect_ext_calls acc cond) tbr) fbr
+    | Extr.ExternalCall (_, fn, a) when pure_ext_fn fn ->
+       collect_ext_calls acc a
+    | Extr.ExternalCall (_, fn, a) ->
+       collect_ext_calls ((fst (hpp.cpp_ext_sigs fn)).ffi_name :: acc) a
+    | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+       Extr.cfoldl (fun _ arg acc -> collect_ext_calls acc arg)
+         argspec rev_args (collect_ext_calls acc body) in
+
+  (* When all registers are values (no read or write can fail anywhere in the
+     schedule), when all rules that fail do so before writing anything, and when
+     no rule reads a register at port 0 after writing it, rules never need to
+     revert their writes and ‘read0’s see the same values as ‘read1’s.  In that
+     case we keep a single copy of the state, updated in place, instead of a
+     rule log ‘log’ and a cycle log ‘Log’: there are no read-write sets, and
+     no resets or commits. *)
+  let log_free =
+    let rEnv = Cuttlebone.Util.contextEnv reg_list in
+    let rec ok (a: (_, var_t, fn_name_t, reg_t, ext_fn_t) Extr.action) =
+      match a with
+      | Extr.APos (_, _, Extr.HistoryAnnot reg_histories, Extr.Fail _) ->
+         may_fail_fast reg_histories
+      | Extr.APos (_, _, Extr.HistoryAnnot reg_histories, Extr.Read (_, Extr.P0, reg)) ->
+         let { Extr.hw0; Extr.hw1; _ } = Extr.getenv rEnv reg_histories reg in
+         Extr.(hw0 = TFalse && hw1 = TFalse)
+      | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> true
+      | Extr.Assign (_, _, _, _, a) | Extr.Write (_, _, _, a)
+      | Extr.Unop (_, _, a) | Extr.ExternalCall (_, _, a) | Extr.APos (_, _, _, a) ->
+         ok a
+      | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+      | Extr.Bind (_, _, _, _, a1, a2) ->
+         ok a1 && ok a2
+      | Extr.If (_, _, cond, tbr, fbr) ->
+         ok cond && ok tbr && ok fbr
+      | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+         Extr.cfoldl (fun _ arg acc -> acc && ok arg) argspec rev_args (ok body) in
+    List.for_all (fun reg -> hpp.cpp_register_kinds reg = Value) reg_list &&
+      List.for_all (fun rl -> ok rl.rl_body) hpp.cpp_rules in
+
+  (* Partition rules into clusters that can be simulated in parallel (see
+     ‘cycle_parallel’): rules that write (or ‘read1’) a register go in the same
+     cluster as all rules that access it, and rules that call the same external function
+     go in the same cluster.  Rules in different clusters then touch disjoint
+     parts of the state, so running each cluster's rules in scheduler order on
+     its own thread is equivalent to running the whole schedule sequentially.
+     This requires a schedule without ‘Try’; we return [] otherwise. *)
+  let parallel_clusters =
+    let rec linearize acc = function
+      | Extr.Done -> Some (List.rev acc)
+      | Extr.Cons (rl_name, s) -> linearize (rl_name :: acc) s
+      | Extr.SPos (_, s) -> linearize acc s
+      | Extr.Try _ -> None in
+    let rules = Array.of_list hpp.cpp_rules in
+    let parent = Array.init (Array.length rules) (fun i -> i) in
+    let rec find i =
+      if parent.(i) = i then i
+      else (let root = find parent.(i) in parent.(i) <- root; root) in
+    let owners = Hashtbl.create 50 in
+    let claim key i =
+      match Hashtbl.find_opt owners key with
+      | Some j -> parent.(find i) <- find j
+      | None -> Hashtbl.add owners key i in
+    let accesses rl reg =
+      let { Extr.hr0; Extr.hr1; Extr.hw0; Extr.hw1; _ } = rl.rl_reg_histories reg in
+      Extr.(hr0 <> TFalse || hr1 <> TFalse || hw0 <> TFalse || hw1 <> TFalse) in
+    let mutates rl reg = (* ‘read1’ updates the register's rwset *)
+      let { Extr.hr1; Extr.hw0; Extr.hw1; _ } = rl.rl_reg_histories reg in
+      Extr.(hr1 <> TFalse || hw0 <> TFalse || hw1 <> TFalse) in
+    Array.iter (fun reg ->
+        if Array.exists (fun rl -> mutates rl reg) rules then
+          Array.iteri (fun i rl ->
+              if accesses rl reg then
+                claim ("reg:" ^ (hpp.cpp_register_sigs reg).reg_name) i)
+            rules)
+      hpp.cpp_registers;
+    Array.iteri (fun i rl ->
+        List.iter (fun fn -> claim ("fn:" ^ fn) i)
+          (collect_ext_calls [] rl.rl_body))
+      rules;
+    let cluster_of_rule = Hashtbl.create 50 in
+    let roots = ref [] in
+    Array.iteri (fun i rl ->
+        let root = find i in
+        if not (List.mem root !roots) then roots := !roots @ [root];
+        Hashtbl.replace cluster_of_rule (hpp.cpp_rule_names ~prefix:"" rl.rl_name) root)
+      rules;
+    match linearize [] hpp.cpp_scheduler with
+    | Some schedule when List.length !roots > 1 && not use_dynamic_logs ->
+       List.map (fun root ->
+           List.filter (fun rl_name ->
+               Hashtbl.find cluster_of_rule (hpp.cpp_rule_names ~prefix:"" rl_name) = root)
+             schedule)
+         !roots
+    | _ -> [] in
+
   let iter_all_registers_with_kind =
     let sigs = Array.map reg_sig_w_kind hpp.cpp_registers in
     fun f -> Array.iter f sigs in
@@ -705,8 +834,18 @@ let compile (type pos_t var_t fn_name_t rule_name_t reg_t ext_fn_t)
     nl ();
 
     let p_sim_class pbody =
-      p_scoped (sprintf "template <typename extfuns_t> class %s" hpp.cpp_classname)
-        ~terminator:";" pbody in
+      (* ‘hooks_t’ is normally the class deriving from this one (CRTP); see
+         ‘cuttlesim::default_hooks’. *)
+      let tparams = "typename extfuns_t, typename hooks_t = void" in
+      let decl = sprintf "template <%s> class %s : public cuttlesim::default_hooks"
+                   tparams hpp.cpp_classname in
+      p_scoped decl ~terminator:";" pbody in
+
+    let p_rule_name_t () =
+      p_scoped "enum class rule_name_t" ~terminator:";" (fun () ->
+          List.iter (fun { rl_name; _ } ->
+              p "%s," (hpp.cpp_rule_names ~prefix:"" rl_name))
+            hpp.cpp_rules) in
 
     let p_state_register r =
       p_decl (reg_type r) r.reg_name in
@@ -762,6 +901,16 @@ let compile (type pos_t var_t fn_name_t rule_name_t reg_t ext_fn_t)
                 Array.iteri p_readvar all_register_sigs);
             p "return cycle_id;") in
 
+      let p_state_hash () =
+        p_fn ~typ:"std::uint64_t" ~name:"hash" ~annot:" const" (fun () ->
+            p "std::uint64_t h = 0;";
+            iter_all_registers (fun r ->
+                p "h ^= cuttlesim::hash_register(%d, %s);"
+                  (register_ids r.reg_name) r.reg_name);
+            p "return h;") in
+
+      p_state_hash ();
+      nl ();
       p_ifnminimal (fun () ->
           p_dump ();
           nl ();
@@ -839,13 +988,14 @@ let compile (type pos_t var_t fn_name_t rule_name_t reg_t ext_fn_t)
 
     let p_log_t () =
       p_scoped "struct log_t" ~terminator:";" (fun () ->
-          p "rwset_t rwset;";
+          if not log_free then p "rwset_t rwset;";
           p "state_t state;";
           nl ();
           p_fn ~typ:"const state_t&" ~name:"snapshot" ~annot:" const" (fun () ->
               p "return state;");
           p_fn ~typ:"explicit" ~name:"log_t" ~args:"const state_t& init"
-            ~annot:" : rwset{}, state(init)" (fun () -> ())) in
+            ~annot:(if log_free then " : state(init)" else " : rwset{}, state(init)")
+            (fun () -> ())) in
 
     let backslash_re =
       Str.regexp "\\\\" in
@@ -863,6 +1013,17 @@ let compile (type pos_t var_t fn_name_t rule_name_t reg_t ext_fn_t)
     (* Map used to avoid collisions between function names *)
     let internal_fnames = Hashtbl.create 20 in
 
+    (* Table mapping function objects to the names of shared implementations
+       (see [collect_intfuns]); unlike [internal_functions], this table is
+       shared by all rules. *)
+    let shared_functions = Hashtbl.create 20 in
+
+    (* Coverage points are numbered across all rules of the module *)
+    let coverage_points = ref 0 in
+    let p_cover () =
+      p "COVER(%d);" !coverage_points;
+      incr coverage_points in
+
     let p_rule (rule: (pos_t, var_t, fn_name_t, rule_name_t, reg_t, ext_fn_t) cpp_rule_t) =
       gensym_reset ();
 
@@ -920,7 +1081,9 @@ them before writing to the registers.\n"
         debug_footprint "rwdata" rwdata_footprint);
 
       let large_footprint footprint = (* FIXME should be tweaked based on the speed of memset *)
-        5 * Array.length footprint > 4 * Array.length hpp.cpp_registers in
+        (* Copying whole structs would race with other clusters' threads *)
+        parallel_clusters = [] &&
+          5 * Array.length footprint > 4 * Array.length hpp.cpp_registers in
 
       let rule_max_log_size =
         Extr.rule_max_log_size rule.rl_body in
@@ -929,22 +1092,198 @@ them before writing to the registers.\n"
         (* LATER: Refine this criterion based on rule_max_log_size; at the moment
            this measure isn't precise enough to be truly useful, because it
            overestimates log sizes in imperative switches. *)
-        use_dynamic_logs && (Array.length rwdata_footprint > 10 ||
+        not log_free &&
+          use_dynamic_logs && (Array.length rwdata_footprint > 10 ||
                                Array.length rwset_footprint > 10) in
 
       let dl_suffix =
-        if use_dynamic_log
+        if log_free then "_LF"
+        else if use_dynamic_log
         then (if use_offsets_in_dynamic_log then "_DOL" else "_DL")
         else "" in
       let fail safe = sprintf "FAIL%s" (if safe then "_FAST" else dl_suffix) in
       let commit = sprintf "COMMIT%s" dl_suffix in
-      let call = sprintf "CALL_FN" in
+      let call = sprintf "CALL_FN%s" (if log_free then "_LF" else "") in
+
+      (* Rules that fail usually do so because of a conflict with an earlier
+         rule (a failed read or write check) or because of a guard on the
+         initial value of a register (e.g. a FIFO's valid bit).  These outcomes
+         are known as soon as the rule starts (read-write sets only grow during
+         a rule, so a check that fails on entry fails later too, and ‘read0’s
+         see the same value throughout the rule), so we test them first: rules
+         that fail then abort before doing any work, and without resetting their
+         logs.  Only checks that are reached on every non-failing path, before
+         any external call or display, are hoisted: these side effects must
+         still happen in rules that fail late. *)
+      let hoisted_guards =
+        let guards = ref [] in
+        let add g = guards := g :: !guards in
+        let add_check g = if not (List.mem g !guards) then add g in
+        let rec is_fail = function
+          | Extr.Fail _ -> true
+          | Extr.APos (_, _, _, a) -> is_fail a
+          | _ -> false in
+        let rec has_effects = function
+          | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> false
+          | Extr.ExternalCall (_, fn, a) when pure_ext_fn fn -> has_effects a
+          | Extr.ExternalCall _ | Extr.Unop (_, Extr.PrimTyped.Display _, _) -> true
+          | Extr.Assign (_, _, _, _, a) | Extr.Write (_, _, _, a)
+          | Extr.Unop (_, _, a) | Extr.APos (_, _, _, a) ->
+             has_effects a
+          | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+          | Extr.Bind (_, _, _, _, a1, a2) ->
+             has_effects a1 || has_effects a2
+          | Extr.If (_, _, cond, tbr, fbr) ->
+             has_effects cond || has_effects tbr || has_effects fbr
+          | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+             Extr.cfoldl (fun _ arg eff -> eff || has_effects arg)
+               argspec rev_args (has_effects body) in
+        let checked reg =
+          hpp.cpp_register_kinds reg <> Value in
+        (* [walk a] records the guards of [a], and returns [false] if execution
+           might not reach the end of [a] without side effects. *)
+        let rec walk = function
+          | Extr.Fail _ -> false
+          | Extr.Var _ | Extr.Const _ -> true
+          | Extr.APos (_, _, Extr.HistoryAnnot _, Extr.Read (_, port, reg)) ->
+             if checked reg then add_check (`Read (port, reg));
+             true
+          | Extr.APos (_, _, Extr.HistoryAnnot _, Extr.Write (_, port, reg, a)) ->
+             walk a && (if checked reg then add_check (`Write (port, reg)); true)
+          | Extr.APos (_, _, _, a) | Extr.Assign (_, _, _, _, a) -> walk a
+          | Extr.ExternalCall (_, fn, a) when pure_ext_fn fn -> walk a
+          | Extr.ExternalCall (_, _, a) | Extr.Unop (_, Extr.PrimTyped.Display _, a) ->
+             ignore (walk a); false
+          | Extr.Unop (_, _, a) -> walk a
+          | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+          | Extr.Bind (_, _, _, _, a1, a2) ->
+             walk a1 && walk a2
+          | Extr.If (_, _, cond, tbr, fbr) ->
+             walk cond &&
+               if is_fail tbr then (add (`Unless (cond, false)); walk fbr)
+               else if is_fail fbr then (add (`Unless (cond, true)); walk tbr)
+               else not (has_effects tbr || has_effects fbr)
+          | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+             Extr.cfoldl (fun _ arg ok -> ok && walk arg) argspec rev_args true
+             && walk body
+          | Extr.Read _ | Extr.Write _ -> false in
+        ignore (walk rule.rl_body);
+        List.rev !guards in
+
+      let hoisted_read0 reg =
+        not use_dynamic_log && List.mem (`Read (Extr.P0, reg)) hoisted_guards in
+
       let rw_suffix reg =
-        if hpp.cpp_register_kinds reg = Value then "_FAST" else dl_suffix in
+        if hpp.cpp_register_kinds reg = Value && not log_free
+        then "_FAST" else dl_suffix in
       let read reg pt =
-        sprintf "READ%d%s" pt (rw_suffix reg) in
+        (* Hoisted ‘read0’ checks hold for the whole rule *)
+        if pt = 0 && hoisted_read0 reg then "READ0_FAST"
+        else sprintf "READ%d%s" pt (rw_suffix reg) in
       let write reg pt = sprintf "WRITE%d%s" pt (rw_suffix reg) in
 
+      (* Small conditionals whose branches have no effects (no failures, writes,
+         assignments, displays, or calls other than to pure external functions,
+         and only unchecked reads) are compiled to branchless selects: both
+         branches are computed (see [efs_pure]), and ‘prims::select’
+         picks one with mask arithmetic.  Muxes on data-dependent conditions
+         (e.g. in an ALU) are otherwise a major source of mispredictions. *)
+      let is_selectable (a: (_, var_t, fn_name_t, reg_t, _) Extr.action) =
+        let budget = ref max_select_ops in
+        let rec ok = function
+          | Extr.Var _ | Extr.Const _ -> true
+          | Extr.APos (_, _, Extr.HistoryAnnot _, Extr.Read (_, port, reg)) ->
+             decr budget;
+             hpp.cpp_register_kinds reg = Value ||
+               (port = Extr.P0 && hoisted_read0 reg)
+          | Extr.APos (_, _, Extr.PosAnnot _, a) -> ok a
+          | Extr.Unop (_, Extr.PrimTyped.Display _, _) -> false
+          | Extr.Unop (_, _, a) -> decr budget; ok a
+          | Extr.Binop (_, _, a1, a2) -> decr budget; ok a1 && ok a2
+          | Extr.ExternalCall (_, fn, a) when pure_ext_fn fn -> decr budget; ok a
+          | Extr.Seq (_, _, a1, a2) | Extr.Bind (_, _, _, _, a1, a2) ->
+             ok a1 && ok a2
+          | Extr.If (_, _, cond, tbr, fbr) ->
+             decr budget; ok cond && ok tbr && ok fbr
+          | Extr.Fail _ | Extr.Assign _ | Extr.Read _ | Extr.Write _
+          | Extr.ExternalCall _ | Extr.InternalCall _ | Extr.APos _ -> false in
+        ok a && !budget >= 0 in
+
+      (* Switches on narrow discriminands whose arms all produce constants (as
+         in instruction decoders or enum-to-bits mappings) are compiled to
+         lookup tables: [Some (tau, table)] maps each value of the discriminand
+         to the value of the corresponding arm. *)
+      let switch_table target (tau: typ) default branches =
+        let rec is_constant = function
+          | Extr.Const _ -> true
+          | Extr.APos (_, _, _, a) -> is_constant a
+          | Extr.Unop (_, Extr.PrimTyped.Display _, _) -> false
+          | Extr.Unop (_, _, a) -> is_constant a
+          | Extr.Binop (_, _, a1, a2) -> is_constant a1 && is_constant a2
+          | _ -> false in
+        let constant a =
+          if is_constant a then Cuttlebone.Util.interp_arithmetic a else None in
+        let key_size = match tau with
+          | Bits_t sz -> sz
+          | Enum_t sg -> sg.enum_bitsize
+          | _ -> max_table_bits + 1 in
+        let arms = List.map (fun (key, a) -> key, constant a) branches in
+        match target, constant default with
+        | VarTarget { tau = (Bits_t _ | Enum_t _) as res_tau; _ }, Some default
+             when key_size <= max_table_bits && typ_sz res_tau <= 64 &&
+                    List.for_all (fun (_, v) -> v <> None) arms ->
+           let table = Array.make (1 lsl key_size) default in
+           (* Earlier arms take precedence *)
+           List.iter (function
+               | key, Some v ->
+                  table.(Z.to_int (bits_to_Z (Cuttlebone.Util.bits_of_value key))) <- v
+               | _, None -> ())
+             (List.rev arms);
+           Some (res_tau, table)
+        | _, _ -> None in
+
+      (* Switches whose arms all read (or all write the same value to) distinct
+         registers of the same type, such as the ‘read’ and ‘write’ functions
+         of register files, are compiled to indexed accesses through a table of
+         pointers to members of ‘state_t’, if these registers are accessed
+         without read-write set checks.  [Some (macro, value, regs)] maps each
+         value of the discriminand to one of these registers. *)
+      let indexed_access (tau: typ) default branches =
+        let rec strip = function
+          | Extr.APos (_, _, _, a) -> strip a
+          | a -> a in
+        let port_id = function Extr.P0 -> 0 | Extr.P1 -> 1 in
+        let access a =
+          match strip a with
+          | Extr.Read (_, port, reg) -> Some ((read reg (port_id port), None), reg)
+          | Extr.Write (_, port, reg, v) -> Some ((write reg (port_id port), Some v), reg)
+          | _ -> None in
+        let unchecked macro =
+          List.mem macro ["READ0_FAST"; "READ1_FAST"; "WRITE0_FAST"; "WRITE1_FAST";
+                          "READ0_LF"; "READ1_LF"; "WRITE0_LF"; "WRITE1_LF"] in
+        let key_size = match tau with
+          | Bits_t sz -> sz
+          | Enum_t sg -> sg.enum_bitsize
+          | _ -> 17 in
+        match List.map (fun (key, a) -> key, access a) branches with
+        | (_, Some ((macro, value) as kind, reg0)) :: _ as arms
+             when key_size <= 16 && unchecked macro ->
+           let reg_tau reg = reg_type (hpp.cpp_register_sigs reg) in
+           let table = Array.make (1 lsl key_size) None in
+           (match access default with
+            | Some (kind', reg) when kind' = kind -> Array.fill table 0 (Array.length table) (Some reg)
+            | _ -> ());
+           let ok = List.for_all (function
+                        | key, Some (kind', reg) when kind' = kind && reg_tau reg = reg_tau reg0 ->
+                           table.(Z.to_int (bits_to_Z (Cuttlebone.Util.bits_of_value key))) <- Some reg;
+                           true
+                        | _ -> false)
+                      (List.rev arms) in
+           if ok && Array.for_all (fun r -> r <> None) table then
+             Some (macro, value, Array.map (function Some r -> r | None -> assert false) table)
+           else None
+        | _ -> None in
+
       let p_copy field src dst footprint =
         let src = sprintf "%s.%s" src field in
         let dst = sprintf "%s.%s" dst field in
@@ -966,6 +1305,16 @@ them before writing to the registers.\n"
       let p_reset () = p_commit_reset "Log" "log" in
       let p_commit () = p_commit_reset "log" "Log" in
 
+      let p_update_state_hash () =
+        (* Registers of the footprint that were not written on this particular
+           path have the same value in both logs, so their terms cancel out. *)
+        p_ifdef "def SIM_STATE_HASH" (fun () ->
+            iter_registers (fun { reg_name; _ } ->
+                let id = register_ids reg_name in
+                p "state_hash ^= cuttlesim::hash_register(%d, Log.state.%s) ^ \
+cuttlesim::hash_register(%d, log.state.%s);" id reg_name id reg_name)
+              rwdata_footprint) in
+
       let p_declare_target = function
         | VarTarget ({ tau; declared = false; name } as ti) ->
            p_decl tau name;
@@ -1087,6 +1436,54 @@ them before writing to the registers.\n"
         | Array2 (_, idx) ->
            PureExpr (sprintf "prims::replace<%d>(%s, %s)" idx a1 a2) in
 
+      (* Print [a] as an expression that can be evaluated on entry into the rule
+         (that is, one built only from constants, ‘read0’s, and calls to pure
+         external functions, which [efs_pure] allows to run before the guards
+         that precede them). *)
+      let rec sp_entry_expr (a: (_, var_t, fn_name_t, reg_t, _) Extr.action) =
+        let pure = function
+          | PureExpr e -> Some e
+          | _ -> None in
+        match a with
+        | Extr.APos (_, _, Extr.PosAnnot _, a) -> sp_entry_expr a
+        | Extr.APos (_, _, Extr.HistoryAnnot _, Extr.Read (_, P0, reg)) ->
+           Some (sprintf "Log.state.%s" (hpp.cpp_register_sigs reg).reg_name)
+        | Extr.Const (_, tau, cst) when not (cpp_type_needs_allocation tau) ->
+           Some (sp_value (Cuttlebone.Util.value_of_extr_value tau cst))
+        | Extr.Unop (_, fn, a) ->
+           (match sp_entry_expr a with
+            | Some a -> pure (p_unop fn a)
+            | None -> None)
+        | Extr.Binop (_, Extr.PrimTyped.Struct2 _, _, _) -> None
+        | Extr.Binop (_, fn, a1, a2) ->
+           (match sp_entry_expr a1, sp_entry_expr a2 with
+            | Some a1, Some a2 -> pure (p_binop NoTarget fn a1 a2)
+            | _, _ -> None)
+        | Extr.ExternalCall (_, fn, a) when pure_ext_fn fn ->
+           let (ffi, kind) = hpp.cpp_ext_sigs fn in
+           (match sp_entry_expr a with
+            | Some a ->
+               Hashtbl.replace program_info.pi_ext_funcalls ffi ();
+               Some (cpp_ext_funcall ffi.ffi_name kind a)
+            | None -> None)
+        | _ -> None in
+
+      let p_hoisted_guards () =
+        let p_guard = function
+          | `Read (port, reg) ->
+             p "GUARD_READ%d(%s);" (match port with Extr.P0 -> 0 | P1 -> 1)
+               (hpp.cpp_register_sigs reg).reg_name
+          | `Write (port, reg) ->
+             p "GUARD_WRITE%d(%s);" (match port with Extr.P0 -> 0 | P1 -> 1)
+               (hpp.cpp_register_sigs reg).reg_name
+          | `Unless (cond, expected) ->
+             match sp_entry_expr cond with
+             | Some c -> p "GUARD(%s%s);" (if expected then "" else "!") c
+             | None -> () in
+        if hoisted_guards <> [] then (
+          List.iter p_guard hoisted_guards;
+          nl ()) in
+
       let assert_no_shadowing sg (v: var_t) (tau: Extr.type0) v_to_string m =
         if Extr.member_mentions_shadowed_binding Cuttlebone.Util.any_eq_dec sg v tau m then
           let vars = String.concat ", " @@ List.map (v_to_string << fst) sg in
@@ -1113,6 +1510,34 @@ them before writing to the registers.\n"
         let bindings, body = loop pos [] action in
         List.rev bindings, body in
 
+      (* Drop bindings of effect-free expressions that nothing refers to *)
+      let drop_dead_bindings bindings body =
+        (* [action_mentions_var] only finds reads of [v], but assignments to [v]
+           need its declaration too *)
+        let rec assigns v = function
+          | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> false
+          | Extr.Assign (_, v', _, _, a) -> v' = v || assigns v a
+          | Extr.Write (_, _, _, a) | Extr.Unop (_, _, a)
+          | Extr.ExternalCall (_, _, a) | Extr.APos (_, _, _, a) ->
+             assigns v a
+          | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+          | Extr.Bind (_, _, _, _, a1, a2) ->
+             assigns v a1 || assigns v a2
+          | Extr.If (_, _, cond, tbr, fbr) ->
+             assigns v cond || assigns v tbr || assigns v fbr
+          | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+             Extr.cfoldl (fun _ arg acc -> acc || assigns v arg)
+               argspec rev_args (assigns v body) in
+        let mentions v a =
+          Extr.action_mentions_var Cuttlebone.Util.any_eq_dec v a || assigns v a in
+        List.fold_right (fun ((var, (_, _, expr)) as binding) live ->
+            let used =
+              mentions var body ||
+                List.exists (fun (_, (_, _, expr)) -> mentions var expr) live in
+            if used || not (Cuttlebone.Util.is_effect_free expr) then binding :: live
+            else live)
+          bindings [] in
+
       let package_intfun fn argspec tau body =
         { Extr.int_name = hpp.cpp_fn_names fn;
           Extr.int_argspec = argspec;
@@ -1129,6 +1554,9 @@ them before writing to the registers.\n"
         let intf = package_intfun fn argspec tau body in
         intf, Hashtbl.find_opt internal_functions intf in
 
+      let lookup_shared_intfun fn argspec tau body =
+        Hashtbl.find_opt shared_functions (package_intfun fn argspec tau body) in
+
       let rec p_action
                 (at_top: bool)
                 (pos: Pos.t) (target: assignment_target)
@@ -1139,6 +1567,7 @@ them before writing to the registers.\n"
         | Extr.APos (_, _, Extr.HistoryAnnot reg_histories,
                      Extr.Fail (_, _)) ->
            let safe = may_fail_fast reg_histories in
+           p_cover ();
            p "%s();" (fail safe);
            (match target with
             | NoTarget -> NotAssigned
@@ -1165,6 +1594,7 @@ them before writing to the registers.\n"
            p_action at_top pos target a2
         | Extr.Bind _ ->
            let bindings, (pos, body) = collect_bindings pos rl in
+           let bindings = drop_dead_bindings bindings body in
            p_declare_target target;
            let p () =
              List.iter (fun (var, (pos, tau, expr)) ->
@@ -1172,22 +1602,31 @@ them before writing to the registers.\n"
              (* Force assignment to prevent variable from escaping scope *)
              p_assign_expr target (p_action false pos target body) in
            if at_top then p () else p_scoped "/* bind */" p
-        | Extr.If (_, _, cond, tbr, fbr) ->
+        | Extr.If (_, tau, cond, tbr, fbr) ->
            p_declare_target target;
            (match reconstruct_switch rl with
             | Some (var, tau, default, branches) ->
                let tau = Cuttlebone.Util.typ_of_extr_type tau in
                p_switch pos target tau var default branches
+            | None when target <> NoTarget && is_selectable tbr && is_selectable fbr ->
+               let ctarget = gensym_target (Bits_t 1) "test" in
+               let c = must_value (p_action false pos ctarget cond) in
+               let tau = Cuttlebone.Util.typ_of_extr_type tau in
+               let t = must_value (p_action false pos (gensym_target tau "t") tbr) in
+               let f = must_value (p_action false pos (gensym_target tau "f") fbr) in
+               p "COVER(bool(%s) ? %d : %d);" c !coverage_points (!coverage_points + 1);
+               coverage_points := !coverage_points + 2;
+               p_assign_expr target (PureExpr (sprintf "prims::select(%s, %s, %s)" c t f))
             | None ->
                let ctarget = gensym_target (Bits_t 1) "test" in
                let cexpr = p_action false pos ctarget cond in
                let tres =
                  p_scoped (sprintf "if (%s)" (must_value cexpr))
-                   (fun () -> p_assign_expr target (p_action true pos target tbr)) in
+                   (fun () -> p_cover (); p_assign_expr target (p_action true pos target tbr)) in
                let fres =
                  if Extr.is_tt fbr then tres
                  else p_scoped "else"
-                        (fun () -> p_assign_expr target (p_action true pos target fbr)) in
+                        (fun () -> p_cover (); p_assign_expr target (p_action true pos target fbr)) in
                assert (tres = fres); tres)
         | Extr.APos (_, _, Extr.HistoryAnnot _,
                      Extr.Read (_, port, reg)) ->
@@ -1227,11 +1666,16 @@ them before writing to the registers.\n"
            Hashtbl.replace program_info.pi_ext_funcalls ffi ();
            (* See ‘Read’ case for why returning just ImpureExpr isn't safe *)
            let expr = cpp_ext_funcall ffi.ffi_name kind (must_value a) in
-           p_assign_impure target (ImpureExpr expr)
+           p_assign_impure target
+             (if kind = `PureFunction then taint [a] (PureExpr expr)
+              else ImpureExpr expr)
         | Extr.InternalCall (_, tau, fn, argspec, rev_args, body) ->
-           let fn_name = match snd (lookup_intfun fn argspec tau body) with
-             | Some fn -> fn
-             | None -> assert false in
+           let call, fn_name =
+             match lookup_shared_intfun fn argspec tau body,
+                   snd (lookup_intfun fn argspec tau body) with
+             | Some fn, _ -> "CALL_SHARED_FN", fn
+             | None, Some fn -> call, fn
+             | None, None -> assert false in
            let args = Extr.cfoldl (fun (argname, tau) arg argstrs ->
                           let tau = Cuttlebone.Util.typ_of_extr_type tau in
                           let argname = hpp.cpp_var_names argname in
@@ -1250,14 +1694,54 @@ them before writing to the registers.\n"
         | Extr.Write (_, _, _, _) -> failwith "Missing annotation on write"
         | Extr.APos (_, _, Extr.HistoryAnnot _, _) -> failwith "Unexpected annotation"
       and p_switch pos target tau var default branches =
+        match switch_table target tau default branches,
+              indexed_access tau default branches with
+        | Some (res_tau, table), _ -> p_switch_table target tau var res_tau table
+        | None, Some (macro, value, regs) ->
+           p_indexed_access pos target tau var macro value regs
+        | None, None -> p_switch_statement pos target tau var default branches
+      and p_indexed_access pos target tau var macro value regs =
+        let r0 = hpp.cpp_register_sigs regs.(0) in
+        let name = gensym "regs" in
+        let members = List.map (fun reg ->
+                          sprintf "&state_t::%s" (hpp.cpp_register_sigs reg).reg_name)
+                        (Array.to_list regs) in
+        p "static constexpr %s state_t::* %s[%d] = { %s };"
+          (cpp_type_of_type (reg_type r0)) name (Array.length regs) (String.concat ", " members);
+        let index = match tau with
+          | Bits_t _ -> sprintf "%s.v" (hpp.cpp_var_names var)
+          | _ -> sprintf "static_cast<std::size_t>(%s)" (hpp.cpp_var_names var) in
+        p "COVER(%d + %s);" !coverage_points index;
+        coverage_points := !coverage_points + Array.length regs;
+        match value with
+        | None ->
+           p_assign_impure target (ImpureExpr (sprintf "%s_AT(%s, %s)" macro name index))
+        | Some value ->
+           let vt = gensym_target (reg_type r0) "v" in
+           let v = must_value (p_action false pos vt value) in
+           p "%s_AT(%s, %s, %s);" macro name index v;
+           p_assign_expr target (PureExpr "prims::tt")
+      and p_switch_table target tau var res_tau table =
+        let name = gensym "table" in
+        let values = List.map sp_value (Array.to_list table) in
+        p "static constexpr %s %s[%d] = { %s };"
+          (cpp_type_of_type res_tau) name (Array.length table) (String.concat ", " values);
+        let index = match tau with
+          | Bits_t _ -> sprintf "%s.v" (hpp.cpp_var_names var)
+          | _ -> sprintf "static_cast<std::size_t>(%s)" (hpp.cpp_var_names var) in
+        p "COVER(%d + %s);" !coverage_points index;
+        coverage_points := !coverage_points + Array.length table;
+        p_assign_expr target (PureExpr (sprintf "%s[%s]" name index))
+      and p_switch_statement pos target tau var default branches =
         let rec loop = function
           | [] ->
-             let res = p_scoped "default:" (fun () -> p_assign_expr target (p_action true pos target default)) in
+             let res = p_scoped "default:" (fun () ->
+                           p_cover (); p_assign_expr target (p_action true pos target default)) in
              p "break;"; (* Ensure that we don't print an empty ‘default:’ case *)
              res
           | (const, action) :: branches ->
              p_scoped (sprintf "case %s:" (sp_value ~immediate:true const))
-               (fun () -> p_assign_and_ignore target (p_action true pos target action));
+               (fun () -> p_cover (); p_assign_and_ignore target (p_action true pos target action));
              p "break;";
              loop branches in
         let varname = hpp.cpp_var_names var in
@@ -1286,7 +1770,7 @@ them before writing to the registers.\n"
         p_scoped (sprintf "%sDEF_%s(%s)" virtual_flag kind args) p_body in
 
       let p_reset_commit () =
-        if not use_dynamic_log then
+        if not use_dynamic_log && not log_free then
           (p_special_fn "RESET" p_reset;
            nl ();
            p_special_fn "COMMIT" p_commit;
@@ -1295,12 +1779,16 @@ them before writing to the registers.\n"
       let p_rule_body () =
         p_special_fn "RULE" (fun () ->
             if use_dynamic_log then (p "dynamic_log_t<%d> dlog{};" rule_max_log_size; nl ());
+            p_hoisted_guards ();
             (try
                p_assign_and_ignore NoTarget (p_action true Pos.Unknown NoTarget rule.rl_body);
              with Failure msg ->
                let msg = sprintf "In %s: %s" rule_name_unprefixed msg in
                Printexc.raise_with_backtrace (Failure msg) (Printexc.get_raw_backtrace ()));
             nl ();
+            p_cover ();
+            if Array.length rwdata_footprint > 0 && not log_free then
+              p_update_state_hash ();
             p "%s();" commit) in
 
       let collect_intfuns pos (action: (_, var_t, fn_name_t, reg_t, _) Extr.action) =
@@ -1313,15 +1801,34 @@ them before writing to the registers.\n"
             else
               loop (counter + 1) in
           loop 0 in
+        (* Functions that do not touch registers and cannot fail do not depend
+           on the rule that calls them, so they are defined once and shared
+           across rules (this avoids duplicating large decoders, ALUs, etc.) *)
+        let rec shareable = function
+          | Extr.Fail _ | Extr.Read _ | Extr.Write _ -> false
+          | Extr.Var _ | Extr.Const _ -> true
+          | Extr.Assign (_, _, _, _, a) | Extr.Unop (_, _, a)
+          | Extr.ExternalCall (_, _, a) | Extr.APos (_, _, _, a) ->
+             shareable a
+          | Extr.Seq (_, _, a1, a2) | Extr.Bind (_, _, _, _, a1, a2)
+          | Extr.Binop (_, _, a1, a2) ->
+             shareable a1 && shareable a2
+          | Extr.If (_, _, c, tbr, fbr) ->
+             shareable c && shareable tbr && shareable fbr
+          | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+             Extr.cfoldl (fun _ arg ok -> ok && shareable arg) argspec rev_args true
+             && shareable body in
         let register_intfun pos fn argspec tau body =
           assert_no_duplicates ~descr:"argument list"
             (List.map (fun (v, _) -> hpp.cpp_var_names v) argspec);
-          match lookup_intfun fn argspec tau body with
-          | _, Some _ -> ()
-          | intf, None ->
+          match lookup_shared_intfun fn argspec tau body,
+                lookup_intfun fn argspec tau body with
+          | Some _, _ | _, (_, Some _) -> ()
+          | None, (intf, None) ->
              let nm = ensure_fresh (hpp.cpp_fn_names fn) in
-             fns := (pos, nm, intf) :: !fns;
-             Hashtbl.add internal_functions intf nm in
+             let shared = shareable body in
+             fns := (pos, nm, intf, shared) :: !fns;
+             Hashtbl.add (if shared then shared_functions else internal_functions) intf nm in
         let rec loop pos = function
           | Extr.Fail _
             | Extr.Var _
@@ -1349,7 +1856,47 @@ them before writing to the registers.\n"
         loop pos action;
         List.rev !fns in
 
-      let p_intfun (pos, name, intf) =
+      (* The expression used to key the memoization cache of [intf], or [None]
+         if [intf] should not be memoized (see [min_memoized_fn_size]) *)
+      let memo_key intf =
+        let rec pure_size = function
+          | Extr.ExternalCall (_, fn, a) when pure_ext_fn fn -> sum [a]
+          | Extr.Fail _ | Extr.Read _ | Extr.Write _
+          | Extr.ExternalCall _ | Extr.Unop (_, Extr.PrimTyped.Display _, _) -> None
+          | Extr.Var _ | Extr.Const _ -> Some 1
+          | Extr.Assign (_, _, _, _, a) | Extr.Unop (_, _, a) | Extr.APos (_, _, _, a) ->
+             sum [a]
+          | Extr.Seq (_, _, a1, a2) | Extr.Bind (_, _, _, _, a1, a2)
+          | Extr.Binop (_, _, a1, a2) ->
+             sum [a1; a2]
+          | Extr.If (_, _, c, tbr, fbr) ->
+             sum [c; tbr; fbr]
+          | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+             sum (body :: Extr.cfoldl (fun _ arg args -> arg :: args) argspec rev_args [])
+        and sum actions =
+          List.fold_left (fun acc a ->
+              match acc, pure_size a with
+              | Some n, Some m -> Some (n + m)
+              | _, _ -> None)
+            (Some 1) actions in
+        let args = List.map (fun (nm, tau) ->
+                       hpp.cpp_var_names nm, Cuttlebone.Util.typ_of_extr_type tau)
+                     intf.Extr.int_argspec in
+        let nbits = List.fold_left (fun n (_, tau) -> n + typ_sz tau) 0 args in
+        match pure_size intf.Extr.int_body with
+        | Some size when size >= min_memoized_fn_size && 0 < nbits && nbits <= 64 ->
+           let _, parts =
+             List.fold_left (fun (offset, parts) (nm, tau) ->
+                 let sz = typ_sz tau in
+                 if sz = 0 then (offset, parts)
+                 else (offset + sz,
+                       sprintf "(static_cast<std::uint64_t>(%s.v) << %d)"
+                         (sp_packer ~arg:nm tau) offset :: parts))
+               (0, []) args in
+           Some (String.concat " | " (List.rev parts))
+        | _ -> None in
+
+      let p_intfun (pos, name, intf, shared) =
         let sp_arg (nm, tau) =
           let tau = Cuttlebone.Util.typ_of_extr_type tau in
           sprintf "%s %s" (cpp_type_of_type tau) (hpp.cpp_var_names nm) in
@@ -1357,11 +1904,26 @@ them before writing to the registers.\n"
         let ret_type = cpp_type_of_type ret_tau in
         let ret_arg = sprintf "%s %s" ret_type "&_ret" in
         let args = String.concat ", " @@ name :: ret_arg :: List.map sp_arg intf.Extr.int_argspec in
-        p "DECL_FN(%s, %s)" name ret_type;
-        p_special_fn "FN" ~args (fun () ->
-            let target = VarTarget { tau = ret_tau; declared = true; name = "_ret" } in
-            p_assign_and_ignore target (p_action true pos target intf.int_body);
-            p "return true;") in
+        let target = VarTarget { tau = ret_tau; declared = true; name = "_ret" } in
+        if shared then (
+          let args = String.concat ", " @@ name :: List.map sp_arg intf.Extr.int_argspec in
+          let memo_key = memo_key intf in
+          p "DECL_SHARED_FN(%s, %s)" name ret_type;
+          if memo_key <> None then p "DECL_MEMO(%s)" name;
+          p_scoped (sprintf "DEF_SHARED_FN(%s)" args) (fun () ->
+              (match memo_key with
+               | Some key -> p "MEMO_LOOKUP(%s, %s);" name key
+               | None -> ());
+              p "%s _ret;" ret_type;
+              p_assign_and_ignore target (p_action true pos target intf.int_body);
+              match memo_key with
+              | Some _ -> p "MEMO_RETURN(%s, _ret);" name
+              | None -> p "return _ret;"))
+        else (
+          p "DECL_FN(%s, %s)" name ret_type;
+          p_special_fn "FN" ~args (fun () ->
+              p_assign_and_ignore target (p_action true pos target intf.int_body);
+              p "return true;")) in
 
       p "#define RULE_NAME %s" rule_name_unprefixed;
       p_reset_commit ();
@@ -1392,40 +1954,91 @@ them before writing to the registers.\n"
           (* Return by value to allow snapshots to outlive their simulation. *)
           p "return snapshot_t(Log.snapshot(), meta);") in
 
+    let p_load_state () =
+      (* The inverse of ‘snapshot_t::save_state’ *)
+      p_fn ~typ:"void" ~name:"load_state" ~args:"std::istream& is" (fun () ->
+          p "std::uint_fast64_t cycle_id = Log.state.vcd_readvars(is);";
+          p_scoped "if (cycle_id != std::numeric_limits<std::uint_fast64_t>::max())"
+            (fun () -> p "meta.cycle_id = cycle_id;");
+          if not log_free then p "log.state = Log.state;";
+          p "rehash();") in
+
+    let p_set_state () =
+      p_fn ~typ:"void" ~name:"set_state" ~args:"const state_t& state" (fun () ->
+          if log_free then p "Log.state = state;"
+          else p "log.state = Log.state = state;";
+          p "rehash();") in
+
+    let p_hash () =
+      (* Without a rule log there is no cheap way to track which registers
+         changed, so log-free models always recompute their hash. *)
+      p_fn ~typ:"std::uint64_t" ~name:"hash" ~annot:" const" (fun () ->
+          if log_free then p "return Log.state.hash();"
+          else (
+            p_ifdef "def SIM_STATE_HASH" (fun () -> p "return state_hash;");
+            p_ifdef "ndef SIM_STATE_HASH" (fun () -> p "return Log.state.hash();")));
+      nl ();
+      p_comment "Call this after modifying Log.state directly";
+      p_fn ~typ:"void" ~name:"rehash" (fun () ->
+          if not log_free then
+            p_ifdef "def SIM_STATE_HASH" (fun () -> p "state_hash = Log.state.hash();")) in
+
     let p_constructor () =
       p_fn ~typ:"explicit" ~name:hpp.cpp_classname
         ~args:"const state_t init = initial_state()"
-        ~annot:" : log(init), Log(init), extfuns{}, meta{}"
-        (fun () -> p_ifnminimal (fun () ->
-                       p "rng.seed(cuttlesim::random_seed);")) in
+        ~annot:(if log_free then " : Log(init), extfuns{}, meta{}"
+                else " : log(init), Log(init), extfuns{}, meta{}")
+        (fun () ->
+          p_ifnminimal (fun () ->
+              p "rng.seed(cuttlesim::random_seed);");
+          p "rehash();") in
+
+    let sp_rule_call rl_name =
+      sprintf "post_rule_hook(rule_name_t::%s, %s())"
+        (hpp.cpp_rule_names ~prefix:"" rl_name) (hpp.cpp_rule_names rl_name) in
 
     let rec p_scheduler pos s =
       p_pos pos;
       match s with
       | Extr.Done -> ()
       | Extr.Cons (rl_name, s) ->
-         p "%s();" (hpp.cpp_rule_names rl_name);
+         p "%s;" (sp_rule_call rl_name);
          p_scheduler pos s
       | Extr.Try (rl_name, s1, s2) ->
-         p_scoped (sprintf "if (%s())" (hpp.cpp_rule_names rl_name)) (fun () ->
+         p_scoped (sprintf "if (%s)" (sp_rule_call rl_name)) (fun () ->
              p_scheduler pos s1);
          p_scoped "else" (fun () -> p_scheduler pos s2)
       | Extr.SPos (pos, s) ->
          p_scheduler (hpp.cpp_pos_of_pos pos) s in
 
-    let p_strobe () =
-      p "_virtual void strobe() const {}" in
+    let p_hooks () =
+      p "using self_t = cuttlesim::hooks_self_t<hooks_t, %s>;" hpp.cpp_classname;
+      nl ();
+      p_fn ~typ:"_inline self_t&" ~name:"self" (fun () ->
+          p "return *static_cast<self_t*>(this);");
+      nl ();
+      p_fn ~typ:"_inline bool" ~name:"post_rule_hook"
+        ~args:"rule_name_t rl, bool fired" (fun () ->
+          p "self().post_rule(rl, fired);";
+          p "return fired;") in
 
     let p_cycle_function pscheduler =
       p "meta.cycle_id++;";
-      p "log.rwset = Log.rwset = rwset_t{};";
+      if not log_free then p "log.rwset = Log.rwset = rwset_t{};";
+      p "self().pre_cycle();";
       pscheduler ();
-      p "strobe();" in
+      p "self().post_cycle();";
+      p_scoped "if (cuttlesim::periodic_hook_due<self_t::periodic_hook_period>(meta.cycle_id))"
+        (fun () -> p "self().periodic();") in
 
     let p_cycle () =
       p_fn ~typ:"void" ~name:"cycle" (fun () ->
           p_cycle_function (fun () ->
-              p_scheduler Pos.Unknown hpp.cpp_scheduler)) in
+              p_scheduler Pos.Unknown hpp.cpp_scheduler);
+          (* Randomized schedules depend on the RNG, which is not part of the
+             hashed state, so only the deterministic ‘cycle’ looks for loops *)
+          p_ifdef "def SIM_STOP_ON_LOOP" (fun () ->
+              p "loops.step(hash(), meta);")) in
 
     let p_cycle_randomized () =
       let nrules = List.length hpp.cpp_rules in
@@ -1439,7 +2052,34 @@ them before writing to the registers.\n"
                     iter_sep (fun () -> p ",") (fun { rl_name; _ } ->
                         pr "&%s%s" prefix (hpp.cpp_rule_names rl_name))
                       hpp.cpp_rules);
-                p "(this->*rules[uniform(rng)])();")) in
+                p "int order[%d];" nrules;
+                p "std::size_t nscheduled = cuttlesim::random_schedule(rng, cuttlesim::random_schedule_mode, order);";
+                p_scoped "for (std::size_t pos = 0; pos < nscheduled; pos++)" (fun () ->
+                    p "int idx = order[pos];";
+                    p "post_rule_hook(static_cast<rule_name_t>(idx), (this->*rules[idx])());"))) in
+
+    let p_cycle_parallel () =
+      List.iteri (fun idx cluster ->
+          p_comment "Cluster %d: %s" idx
+            (String.concat ", " (List.map (hpp.cpp_rule_names ~prefix:"") cluster)))
+        parallel_clusters;
+      p_fn ~typ:"void" ~name:"cycle_cluster" ~args:"std::size_t cluster" (fun () ->
+          p_scoped "switch (cluster)" (fun () ->
+              List.iteri (fun idx cluster ->
+                  p "case %d:" idx;
+                  List.iter (fun rl_name -> p "%s;" (sp_rule_call rl_name)) cluster;
+                  p "break;")
+                parallel_clusters));
+      nl ();
+      p_fn ~typ:"void" ~name:"cycle_parallel" ~args:"cuttlesim::cluster_pool& pool" (fun () ->
+          p_cycle_function (fun () ->
+              p "pool.step(this, [](void* sim, std::size_t cluster) {";
+              p "static_cast<%s*>(sim)->cycle_cluster(cluster);" hpp.cpp_classname;
+              p "});")) in
+
+    let p_reseed () =
+      p_fn ~typ:"void" ~name:"reseed" ~args:"std::uint64_t seed" (fun () ->
+          p "rng.seed(seed);") in
 
     let run_typ =
       sprintf "_flatten %s&" hpp.cpp_classname in
@@ -1455,6 +2095,15 @@ them before writing to the registers.\n"
           p_cycle_loop (fun () -> p "%s();" cycle);
           p "return *this;") in
 
+    let p_run_parallel () =
+      p_fn ~typ:run_typ ~name:"run_parallel" ~args:"std::uint_fast64_t ncycles" (fun () ->
+          if parallel_clusters = [] then
+            p "return run(ncycles);"
+          else (
+            p "cuttlesim::cluster_pool pool{nclusters};";
+            p_cycle_loop (fun () -> p "cycle_parallel(pool);");
+            p "return *this;")) in
+
     let p_trace name cycle =
       p_fn ~typ:run_typ ~name
         ~args:"std::string fname, std::uint_fast64_t ncycles" (fun () ->
@@ -1475,44 +2124,69 @@ them before writing to the registers.\n"
         nl ();
         p_snapshot_t ();
         nl ();
+        p_rule_name_t ();
+        nl ();
 
         p "protected:";
-        p_rwset_t ();
-        nl ();
+        if not log_free then
+          (p_rwset_t ();
+           nl ());
         p_log_t ();
         nl ();
-        if use_dynamic_logs then
+        if use_dynamic_logs && not log_free then
           (p_dynamic_log_t ();
            nl ());
-        p "log_t log;";
+        if log_free then
+          p_comment "All rules of this model are conflict-free: no rule log"
+        else p "log_t log;";
         p "log_t Log;";
         p "extfuns_t extfuns;";
         p "cuttlesim::sim_metadata meta;";
         nl ();
         p_ifnminimal (fun () ->
-            p "std::default_random_engine rng{};";
-            p "std::uniform_int_distribution<int> uniform{0, %d};"
-              (max 0 (List.length hpp.cpp_rules - 1)));
+            p "cuttlesim::xoshiro256ss rng{};");
+        if not log_free then
+          p_ifdef "def SIM_STATE_HASH" (fun () ->
+              p "std::uint64_t state_hash = 0;");
+        p_ifdef "def SIM_STOP_ON_LOOP" (fun () ->
+            p "cuttlesim::loop_detector loops{};");
+        nl ();
+        p_hooks ();
         nl ();
         iter_sep nl p_rule hpp.cpp_rules;
         nl ();
 
         p "public:";
+        p "static constexpr std::size_t coverage_points = %d;" !coverage_points;
+        p "static constexpr std::size_t nclusters = %d;" (max 1 (List.length parallel_clusters));
+        nl ();
         p_finish ();
         nl ();
         p_snapshot ();
         nl ();
+        p_hash ();
+        nl ();
+        p_set_state ();
+        nl ();
+        p_ifnminimal p_load_state;
+        nl ();
         p_initial_state ();
         nl ();
         p_constructor ();
         nl ();
-        p_strobe ();
-        nl ();
         p_cycle ();
         nl ();
         p_run "run" "cycle";
         nl ();
+        p_ifdef "def SIM_PARALLEL" (fun () ->
+            if parallel_clusters <> [] then
+              (p_cycle_parallel ();
+               nl ());
+            p_run_parallel ());
+        nl ();
         p_ifnminimal (fun () ->
+            p_reseed ();
+            nl ();
             p_cycle_randomized ();
             nl ();
             p_run "run_randomized" "cycle_randomized";
@@ -1548,6 +2222,7 @@ them before writing to the registers.\n"
             p "public:";
             p_comment "External methods (if any) should be implemented here.";
             p_comment "Approximate signatures are provided below for convenience.";
+            p_comment "With SIM_FUZZ, use cuttlesim::fuzz::draw<N>() to return fuzzer-chosen values.";
             let fns = List.of_seq (Hashtbl.to_seq_keys program_info.pi_ext_funcalls) in
             List.iter p_extfun_decl (List.sort compare fns))) in
 
@@ -1582,7 +2257,8 @@ let input_of_compile_unit (cu: 'f Cuttlebone.Compilation.compile_unit) =
   let reg_histories, annotated_rules, register_kinds =
     Cuttlebone.Util.compute_register_histories
       Cuttlebone.Compilation._R cu.c_registers
-      (List.map fst cu.c_rules) rulemap cu.c_scheduler in
+      (List.map fst cu.c_rules)
+      (Cuttlebone.Util.simplify_action << rulemap) cu.c_scheduler in
   let swap_body (name, (kind, _))
       : (_ * (_ * (_, Common.var_t, Common.fn_name_t, Common.reg_signature, 'c)
                     Cuttlebone.Extr.annotated_rule)) =
@@ -1616,13 +2292,16 @@ let input_of_sim_package
   let reg_histories, annotated_rules, register_kinds =
     Util.compute_register_histories
       kp.koika_reg_types kp.koika_reg_finite.finite_elements
-      rule_names kp.koika_rules kp.koika_scheduler in
+      rule_names (Util.simplify_action << kp.koika_rules) kp.koika_scheduler in
   let classname = Util.string_of_coq_string kp.koika_module_name in
   let ext_fn_sigs f =
     let spec = sp.sp_ext_fn_specs f in
     let name = Util.string_of_coq_string spec.efs_name in
     let fsig = Util.ffi_sig_of_extr_external_sig name (kp.koika_ext_fn_types f) in
-    let kind = if spec.efs_method then `Method else `Function in
+    let kind =
+      if spec.efs_method then `Method
+      else if spec.efs_pure then `PureFunction
+      else `Function in
     (fsig, kind) in
   let registers = kp.koika_reg_finite.finite_elements in
   { cpp_classname = classname;
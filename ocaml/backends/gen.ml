@@ -18,5 +18,9 @@ let _ =
   defvar out "cuttlesim_cpp" "cuttlesim.cpp";
   defvar out "verilator_hpp" "verilator.hpp";
   defvar out "verilator_cpp" "verilator.cpp";
+  defvar out "lockstep_hpp" "lockstep.hpp";
+  defvar out "lockstep_cpp" "lockstep.cpp";
+  defvar out "bitsliced_hpp" "bitsliced.hpp";
+  defvar out "bitsliced_cpp" "bitsliced.cpp";
   defvar out "makefile" "Makefile";
   close_out out
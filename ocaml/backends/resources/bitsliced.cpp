@@ -0,0 +1,7 @@
+/*! Default driver for Kôika programs compiled to bit-sliced C++ models !*/
+#include "__CUTTLEC_MODULE_NAME__.bitsliced.hpp"
+
+__CUTTLEC_EXTFUNS__
+class simulator final : public __CUTTLEC_BITSLICED_CLASS__<extfuns> {};
+
+int main(int argc, char **argv) { return bitsliced::main<simulator>(argc, argv); }
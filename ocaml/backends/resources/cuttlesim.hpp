@@ -16,9 +16,48 @@
 #include <iomanip> // For std::setfill
 #include <iostream>
 #include <fstream> // For VCD files
-#include <random> // For executing rules in random order
 #endif // #ifndef SIM_MINIMAL
 
+#ifdef SIM_SWEEP
+#ifdef SIM_TRACE
+#error "SIM_SWEEP and SIM_TRACE are incompatible"
+#endif
+#include <atomic>
+#include <map> // For grouping failures
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+#endif // #ifdef SIM_SWEEP
+
+#if defined(SIM_STOP_ON_LOOP) && !defined(SIM_STATE_HASH)
+#define SIM_STATE_HASH
+#endif
+
+#ifdef SIM_PARALLEL
+#if defined(SIM_STATE_HASH) || defined(SIM_FUZZ)
+#error "SIM_PARALLEL is incompatible with SIM_STATE_HASH and SIM_FUZZ"
+#endif
+#ifdef SIM_MEMOIZE
+#error "SIM_PARALLEL is incompatible with SIM_MEMOIZE" // Caches are not thread-safe
+#endif
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif // #ifdef SIM_PARALLEL
+
+#ifdef SIM_FUZZ
+#if defined(SIM_MINIMAL) || defined(SIM_SWEEP)
+#error "SIM_FUZZ is incompatible with SIM_MINIMAL and SIM_SWEEP"
+#endif
+#include <map> // For deduplicating failures
+#include <vector>
+#endif // #ifdef SIM_FUZZ
+
+#if defined(SIM_MEMO_STATS) && defined(SIM_MINIMAL)
+#error "SIM_MEMO_STATS is incompatible with SIM_MINIMAL"
+#endif
+
 #ifdef SIM_DEBUG
 #include <iostream>
 static inline void _sim_assert_fn(const char* repr,
@@ -48,12 +87,6 @@ static inline void _sim_assert_fn(const char* repr,
 #define _unoptimized
 #endif
 
-#ifndef SIM_MINIMAL
-#define _virtual virtual
-#else
-#define _virtual
-#endif
-
 #if defined(SIM_MINIMAL) && defined(SIM_KEEP_DISPLAY)
 #define _display_unoptimized _unoptimized
 #else
@@ -786,6 +819,19 @@ namespace prims {
     return tt;
   }
 
+  // Branchless version of ‘cond ? t : f’, used for small conditionals whose
+  // branches have no side effects.
+  template<bitwidth sz>
+  bits<sz> select(const bits<1> cond, const bits<sz> t, const bits<sz> f) {
+    const auto mask = static_cast<bits_t<sz>>(bits_t<sz>(0) - static_cast<bits_t<sz>>(cond.v));
+    return bits<sz>::mk((t.v & mask) | (f.v & static_cast<bits_t<sz>>(~mask)));
+  }
+
+  template<typename T>
+  T select(const bits<1> cond, const T& t, const T& f) {
+    return bool(cond) ? t : f;
+  }
+
   /// ## Type info
 
   template<typename T> struct type_info;
@@ -1061,17 +1107,121 @@ namespace cuttlesim {
 
   /// # Randomization
 
+  // xoshiro256** (Blackman & Vigna): much faster than the standard library's
+  // engines, and its state is small enough to copy along with a model.
+  struct xoshiro256ss {
+    std::uint64_t s[4];
+
+    static std::uint64_t rotl(std::uint64_t x, int k) {
+      return (x << k) | (x >> (64 - k));
+    }
+
+    // Expand ‘seed’ with splitmix64, as recommended by the authors
+    void seed(std::uint64_t seed) {
+      for (auto& word : s) {
+        std::uint64_t z = (seed += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        word = z ^ (z >> 31);
+      }
+    }
+
+    std::uint64_t operator()() {
+      std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+      std::uint64_t t = s[1] << 17;
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = rotl(s[3], 45);
+      return result;
+    }
+
+    // A number in [0, n) (multiply-shift; the bias is negligible for the
+    // small values of ‘n’ that we use).
+    std::uint32_t below(std::uint32_t n) {
+      return static_cast<std::uint32_t>(((*this)() >> 32) * n >> 32);
+    }
+
+    xoshiro256ss() : s{} { seed(0); }
+  };
+
+  // How ‘cycle_randomized’ picks rules in each cycle:
+  // - single: one rule, chosen uniformly;
+  // - permutation: all rules, in a random order;
+  // - subset: a random subset of the rules, in a random order.
+  enum class schedule_mode { single, permutation, subset };
+
+  // The ‘SIM_SCHEDULE’ value that selects ‘mode’.
+  static _unused const char* schedule_mode_name(schedule_mode mode) {
+    switch (mode) {
+    case schedule_mode::permutation:
+      return "permutation";
+    case schedule_mode::subset:
+      return "subset";
+    default:
+      return "single";
+    }
+  }
+
+  // Fill ‘order’ with the indices of the rules to run this cycle and return
+  // how many there are.
+  template<std::size_t N>
+  static _unused std::size_t random_schedule(xoshiro256ss& rng, schedule_mode mode, int (&order)[N]) {
+    std::size_t n = 0;
+    switch (mode) {
+    case schedule_mode::single:
+      order[n++] = static_cast<int>(rng.below(N));
+      return n;
+    case schedule_mode::permutation:
+      for (; n < N; n++)
+        order[n] = static_cast<int>(n);
+      break;
+    case schedule_mode::subset:
+      for (std::size_t rl = 0, bits = 0; rl < N; rl++, bits >>= 1) {
+        if (rl % 64 == 0)
+          bits = rng();
+        if (bits & 1)
+          order[n++] = static_cast<int>(rl);
+      }
+      break;
+    }
+    for (std::size_t i = n; i > 1; i--) // Fisher-Yates
+      std::swap(order[i - 1], order[rng.below(static_cast<std::uint32_t>(i))]);
+    return n;
+  }
+
   namespace internal {
     std::size_t gen_seed() {
       if (char* seed = std::getenv("SIM_RANDOMIZED")) {
-        return std::hash<std::string>{}(seed);
+        // Numeric seeds are used as-is, so that seeds reported by ‘sweep’ can
+        // be replayed.
+        std::string str{seed};
+        if (!str.empty() && str.find_first_not_of("0123456789") == std::string::npos)
+          return std::stoull(str);
+        return std::hash<std::string>{}(str);
       }
       auto now = std::chrono::high_resolution_clock::now();
       return now.time_since_epoch().count();
     }
+
+    schedule_mode gen_schedule_mode() {
+      if (char* mode = std::getenv("SIM_SCHEDULE")) {
+        std::string str{mode};
+        if (str == "permutation")
+          return schedule_mode::permutation;
+        if (str == "subset")
+          return schedule_mode::subset;
+        if (str != "single")
+          std::cerr << "WARNING: unknown SIM_SCHEDULE ‘" << str << "’, using ‘single’" << std::endl;
+      }
+      return schedule_mode::single;
+    }
   }
 
   static _unused std::size_t random_seed = internal::gen_seed();
+  static _unused schedule_mode random_schedule_mode = internal::gen_schedule_mode();
 } // namespace cuttlesim
 #endif // #ifndef SIM_MINIMAL
 
@@ -1248,10 +1398,278 @@ namespace cuttlesim {
     sim_metadata() :
       finished{false},
       exit_code{0},
-      exit_config{exit_info_state}
+      exit_config{exit_info_state},
+      cycle_id{0}
     {}
   };
 
+  /// ## Hooks
+
+  // Generated models call these hooks at fixed points of each cycle.  To use
+  // them, derive from the model, pass the derived class as the model's second
+  // template parameter (‘hooks_t’, CRTP-style), and shadow the hooks that you
+  // need.  Calls are resolved statically, so unused hooks compile to nothing.
+  struct default_hooks {
+    // Call ‘periodic()’ every ‘periodic_hook_period’ cycles (0 to disable)
+    static constexpr std::uint_fast64_t periodic_hook_period = 0;
+
+    void pre_cycle() {}
+    void post_cycle() {}
+    template<typename rule_name_t>
+    void post_rule(rule_name_t /*rl*/, bool /*fired*/) {}
+    void periodic() {}
+  };
+
+  template<typename hooks_t, typename model_t>
+  using hooks_self_t = std::conditional_t<std::is_void<hooks_t>::value, model_t, hooks_t>;
+
+  template<std::uint_fast64_t period>
+  static _unused bool periodic_hook_due(std::uint_fast64_t cycle_id) {
+    return period != 0 && cycle_id % (period != 0 ? period : 1) == 0;
+  }
+
+  /// ## State hashing
+
+  // The hash of a state is the XOR of the hashes of its registers, so models
+  // can update it when a rule commits (‘h ^= hash(old) ^ hash(new)’ for each
+  // register that the rule writes) instead of rehashing the whole state.  Use
+  // it for cheap (probabilistic) equality checks; compare states to be sure.
+
+  static _unused std::uint64_t mix64(std::uint64_t z) { // splitmix64's finalizer
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  template<prims::bitwidth sz>
+  static _unused std::uint64_t hash_bits(std::uint64_t h, const prims::bits<sz>& val) {
+    bits_t<sz> v = static_cast<bits_t<sz>>(val);
+    for (prims::bitwidth pos = 0; pos < std::max<prims::bitwidth>(sz, 1); pos += 64)
+      h = mix64(h ^ static_cast<std::uint64_t>((v >> pos) & std::numeric_limits<std::uint64_t>::max()));
+    return h;
+  }
+
+  // ‘reg_id’ distinguishes registers that hold the same value
+  template<typename T>
+  static _unused std::uint64_t hash_register(std::uint64_t reg_id, const T& val) {
+    return hash_bits(reg_id * 0x9e3779b97f4a7c15, prims::pack(val));
+  }
+
+  // Detects when a sequence of states starts repeating, using Brent's
+  // algorithm: constant memory, and a loop of period λ is found at most 2λ
+  // steps after entering it.  Only the register state is hashed, so this is
+  // only meaningful for deterministic schedules (‘cycle’, not
+  // ‘cycle_randomized’) and stateless external functions: memories, input
+  // devices, and ‘fuzz::draw’ make a repeated register state a false alarm.
+  struct loop_detector {
+    // Exit code of simulations stopped by SIM_STOP_ON_LOOP (as in timeout(1))
+    static constexpr int exit_code = 124;
+
+    std::uint64_t saved_hash;
+    std::uint64_t power;
+    std::uint64_t period;
+    bool started;
+
+    // Returns true if ‘hash’ was seen ‘period’ steps ago
+    bool step(std::uint64_t hash) {
+      if (!started) {
+        started = true;
+        saved_hash = hash;
+        return false;
+      }
+      period++;
+      if (hash == saved_hash)
+        return true;
+      if (period == power) {
+        saved_hash = hash;
+        power *= 2;
+        period = 0;
+      }
+      return false;
+    }
+
+    // Stop the simulation when a loop is found (see SIM_STOP_ON_LOOP)
+    void step(std::uint64_t hash, sim_metadata& meta) {
+      if (step(hash)) {
+#ifndef SIM_MINIMAL
+        std::cerr << "Cycle " << meta.cycle_id << ": state repeats with period "
+                  << period << "; stopping." << std::endl;
+#endif
+        meta.finished = true;
+        meta.exit_code = exit_code;
+      }
+    }
+
+    loop_detector() : saved_hash{0}, power{1}, period{0}, started{false} {}
+  };
+
+  /// ## Memoization
+
+  // Direct-mapped cache for the results of a pure function, keyed by its
+  // packed arguments (see ‘MEMO_LOOKUP’).  Define SIM_MEMO_STATS to count hits
+  // and misses (these are printed when the cache is destroyed).
+  template<typename T>
+  struct memo_cache {
+    static constexpr std::size_t size = 256;
+
+    std::array<std::uint64_t, size> keys;
+    std::array<T, size> values;
+    std::array<bool, size> valid;
+#ifdef SIM_MEMO_STATS
+    const char* name;
+    std::uint64_t hits, misses;
+#endif
+
+    static std::size_t index(std::uint64_t key) { // Fibonacci hashing
+      return static_cast<std::size_t>((key * 0x9e3779b97f4a7c15) >> 56);
+    }
+
+    const T* find(std::uint64_t key) {
+      std::size_t idx = index(key);
+      bool hit = valid[idx] && keys[idx] == key;
+#ifdef SIM_MEMO_STATS
+      (hit ? hits : misses)++;
+#endif
+      return hit ? &values[idx] : nullptr;
+    }
+
+    const T& store(std::uint64_t key, const T& value) {
+      std::size_t idx = index(key);
+      keys[idx] = key;
+      values[idx] = value;
+      valid[idx] = true;
+      return values[idx];
+    }
+
+#ifdef SIM_MEMO_STATS
+    explicit memo_cache(const char* name)
+      : keys{}, values{}, valid{}, name{name}, hits{0}, misses{0} {}
+
+    ~memo_cache() {
+      if (hits + misses > 0)
+        std::cerr << "memo " << name << ": " << hits << " hits, "
+                  << misses << " misses" << std::endl;
+    }
+#else
+    explicit memo_cache(const char* /* name */) : keys{}, values{}, valid{} {}
+#endif
+  };
+
+#ifdef SIM_PARALLEL
+  /// ## Parallel simulation
+
+  // Models whose rules form independent clusters (no shared registers or
+  // external functions; see ‘parallel_clusters’ in cpp.ml) simulate each
+  // cluster on its own thread in ‘run_parallel’.  Post-rule hooks then run
+  // concurrently, and external functions called by different clusters must
+  // not share state.
+  //
+  // Each call to ‘step’ runs ‘fn(ctx, cluster)’ once for each cluster and
+  // waits for all of them to complete.  Clusters are distributed round-robin
+  // across at most one thread per core, and the calling thread takes its share.
+  // Threads spin between steps, since a cycle is much shorter than the time
+  // it takes to wake up a sleeping thread.
+  class cluster_pool {
+    using task_t = void (*)(void*, std::size_t);
+
+    std::atomic<std::uint64_t> generation;
+    std::atomic<std::size_t> pending;
+    std::atomic<bool> stopping;
+    std::size_t nclusters;
+    std::size_t nthreads;
+    task_t task;
+    void* ctx;
+    std::vector<std::thread> threads;
+
+    template<typename Pred>
+    static void spin_until(Pred pred) {
+      for (unsigned spins = 0; !pred(); spins++) {
+        if (spins > 1024)
+          std::this_thread::yield();
+      }
+    }
+
+    void run_share(std::size_t thread_id) {
+      for (std::size_t cluster = thread_id; cluster < nclusters; cluster += nthreads)
+        task(ctx, cluster);
+    }
+
+    void worker(std::size_t thread_id) {
+      std::uint64_t seen = 0;
+      for (;;) {
+        spin_until([&] { return generation.load(std::memory_order_acquire) != seen; });
+        seen++;
+        if (stopping.load(std::memory_order_relaxed))
+          return;
+        run_share(thread_id);
+        pending.fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+  public:
+    void step(void* step_ctx, task_t step_task) {
+      ctx = step_ctx;
+      task = step_task;
+      pending.store(threads.size(), std::memory_order_relaxed);
+      generation.fetch_add(1, std::memory_order_release);
+      run_share(0);
+      spin_until([&] { return pending.load(std::memory_order_acquire) == 0; });
+    }
+
+    explicit cluster_pool(std::size_t ncl)
+      : generation{0}, pending{0}, stopping{false}, nclusters{ncl},
+        nthreads{std::max<std::size_t>(1, std::min<std::size_t>(ncl, std::thread::hardware_concurrency()))},
+        task{nullptr}, ctx{nullptr}, threads{} {
+      for (std::size_t thread_id = 1; thread_id < nthreads; thread_id++)
+        threads.emplace_back(&cluster_pool::worker, this, thread_id);
+    }
+
+    ~cluster_pool() {
+      stopping.store(true, std::memory_order_relaxed);
+      generation.fetch_add(1, std::memory_order_release);
+      for (auto& thread : threads)
+        thread.join();
+    }
+
+    cluster_pool(const cluster_pool&) = delete;
+    cluster_pool& operator=(const cluster_pool&) = delete;
+  };
+#endif // #ifdef SIM_PARALLEL
+
+#ifdef SIM_FUZZ
+  /// ## Fuzzing
+
+  namespace fuzz {
+    // Hit counts of the coverage points of generated rules (see ‘COVER’);
+    // point ids wrap around if a design has more points than the map has cells.
+    static constexpr std::size_t coverage_map_size = 1 << 16;
+    static std::uint8_t coverage[coverage_map_size];
+
+    // The input that the fuzzer is currently running
+    struct input_t {
+      const std::uint8_t* data;
+      std::size_t size;
+      std::size_t pos;
+    };
+
+    static input_t input{nullptr, 0, 0};
+
+    static _unused std::uint8_t draw_byte() {
+      return input.pos < input.size ? input.data[input.pos++] : 0;
+    }
+
+    // Use this in extfuns to let the fuzzer choose their return values (once
+    // the input is exhausted, all values are zeros).
+    template<prims::bitwidth sz>
+    static _unused prims::bits<sz> draw() {
+      bits_t<sz> v = 0;
+      for (std::size_t byte = 0; byte < (sz + 7) / 8; byte++)
+        v = static_cast<bits_t<sz>>((v << 8) | draw_byte());
+      return prims::bits<sz>::mk(v & prims::bits<sz>::bitmask());
+    }
+  }
+#endif // #ifdef SIM_FUZZ
+
   template<typename state_t>
   struct snapshot_t {
     state_t state;
@@ -1264,6 +1682,12 @@ namespace cuttlesim {
       return meta.exit_code;
     }
 
+    // See ‘load_state’ in generated models
+    void save_state(std::ostream& os) const {
+      state_t::vcd_header(os);
+      state.vcd_dumpvars(meta.cycle_id, os, state, true);
+    }
+
     snapshot_t(state_t _state, sim_metadata _meta) : state(_state), meta(_meta) {}
 #else
     snapshot_t(state_t _state, sim_metadata _meta) : state(_state) {}
@@ -1286,6 +1710,14 @@ namespace cuttlesim {
     return simulator(std::forward<Args>(args)...).run(ncycles).snapshot();
   }
 
+#ifdef SIM_PARALLEL
+  template <typename simulator, typename... Args>
+  _unused _flatten static __attribute__((noinline)) typename simulator::snapshot_t
+  init_and_run_parallel(ull ncycles, Args&&... args) {
+    return simulator(std::forward<Args>(args)...).run_parallel(ncycles).snapshot();
+  }
+#endif
+
 #ifndef SIM_MINIMAL
   template <typename simulator, typename... Args>
   _unused _flatten static __attribute__((noinline)) typename simulator::snapshot_t
@@ -1305,13 +1737,247 @@ namespace cuttlesim {
     return simulator(std::forward<Args>(args)...).trace_randomized(fname, ncycles).snapshot();
   }
 
+#ifdef SIM_SWEEP
+  /// ## Seed sweeps
+
+  // Run ‘nseeds’ randomized simulations (seeds 0 to nseeds - 1) on ‘nthreads’
+  // threads, then report the seeds of failing runs (nonzero exit code),
+  // grouped by exit code and cycle of failure.
+  template<typename simulator, typename... Args>
+  static _unused int sweep(ull ncycles, ull nseeds, unsigned nthreads, const Args&... args) {
+    struct failure {
+      ull seed;
+      int exit_code;
+      std::uint_fast64_t cycle_id;
+      std::uint64_t state_hash;
+    };
+
+    std::atomic<ull> next_seed{0};
+    std::mutex failures_mutex;
+    std::vector<failure> failures;
+
+    auto worker = [&]() {
+      for (ull seed = next_seed++; seed < nseeds; seed = next_seed++) {
+        simulator sim(args...);
+        sim.reseed(seed);
+        auto meta = sim.run_randomized(ncycles).snapshot().meta;
+        if (meta.exit_code != 0) {
+          std::lock_guard<std::mutex> lock(failures_mutex);
+          failures.push_back(failure{seed, meta.exit_code, meta.cycle_id, sim.hash()});
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread = 0; thread < std::max(nthreads, 1u); thread++)
+      threads.emplace_back(worker);
+    for (auto& thread : threads)
+      thread.join();
+
+    // Seeds that end in the same state (up to hash collisions) fail identically
+    std::map<std::tuple<int, std::uint_fast64_t, std::uint64_t>, std::vector<ull>> groups;
+    for (const auto& f : failures)
+      groups[std::make_tuple(f.exit_code, f.cycle_id, f.state_hash)].push_back(f.seed);
+
+    std::cerr << "sweep: " << failures.size() << "/" << nseeds << " seeds failed ("
+              << groups.size() << " distinct failures)" << std::endl;
+    for (auto& group : groups) {
+      auto& seeds = group.second;
+      std::sort(seeds.begin(), seeds.end());
+      std::cerr << "  exit code " << std::get<0>(group.first)
+                << " at cycle " << std::get<1>(group.first) << ": "
+                << seeds.size() << " seeds, rerun with SIM_SCHEDULE="
+                << schedule_mode_name(random_schedule_mode)
+                << " SIM_RANDOMIZED=" << seeds[0]
+                << std::endl;
+    }
+
+    return failures.empty() ? 0 : 1;
+  }
+#endif
+
+#ifdef SIM_FUZZ
+  /// ## Coverage-guided fuzzing
+
+  namespace fuzz {
+    using input_data = std::vector<std::uint8_t>;
+
+    static constexpr std::size_t max_input_size = 4096;
+
+    // Hit counts are bucketed as in AFL, so that loops running a few more
+    // times don't count as new coverage.
+    static std::uint8_t bucket(std::uint8_t count) {
+      if (count <= 3) return count;
+      if (count <= 7) return 4;
+      if (count <= 15) return 8;
+      if (count <= 31) return 16;
+      if (count <= 127) return 32;
+      return 128;
+    }
+
+    template<typename simulator>
+    static constexpr std::size_t npoints() {
+      return std::min(simulator::coverage_points, coverage_map_size);
+    }
+
+    // Fast reset: each input runs on a freshly constructed simulator, which
+    // is much cheaper than forking when designs are small.
+    template<typename simulator, typename... Args>
+    static sim_metadata run_one(const input_data& data, ull ncycles, const Args&... args) {
+      std::memset(coverage, 0, npoints<simulator>());
+      input = input_t{data.data(), data.size(), 0};
+      simulator sim(args...);
+      return sim.run(ncycles).snapshot().meta;
+    }
+
+    // Update ‘seen’ with the buckets hit by the last run; return the number of
+    // new (point, bucket) pairs.
+    static std::size_t merge_coverage(std::vector<std::uint8_t>& seen) {
+      std::size_t fresh = 0;
+      for (std::size_t id = 0; id < seen.size(); id++) {
+        if (coverage[id] == 0)
+          continue;
+        std::uint8_t b = bucket(coverage[id]);
+        if (!(seen[id] & b)) {
+          seen[id] |= b;
+          fresh++;
+        }
+      }
+      return fresh;
+    }
+
+    static void mutate(input_data& data, const std::vector<input_data>& corpus,
+                       xoshiro256ss& rng) {
+      std::size_t nmutations = 1 + rng.below(4);
+      for (std::size_t m = 0; m < nmutations; m++) {
+        std::size_t pos = data.empty() ? 0 : rng.below(data.size());
+        switch (rng.below(data.empty() ? 1 : 5)) {
+        case 0: { // Insert random bytes
+          std::size_t len = 1 + rng.below(8);
+          for (std::size_t i = 0; i < len && data.size() < max_input_size; i++)
+            data.insert(data.begin() + pos, static_cast<std::uint8_t>(rng()));
+          break;
+        }
+        case 1: // Flip a bit
+          data[pos] ^= static_cast<std::uint8_t>(1 << rng.below(8));
+          break;
+        case 2: // Overwrite a byte
+          data[pos] = static_cast<std::uint8_t>(rng());
+          break;
+        case 3: { // Erase a range
+          std::size_t len = 1 + rng.below(std::min<std::size_t>(8, data.size() - pos));
+          data.erase(data.begin() + pos, data.begin() + pos + len);
+          break;
+        }
+        case 4: { // Splice in part of another input
+          const input_data& other = corpus[rng.below(corpus.size())];
+          if (other.empty())
+            break;
+          std::size_t from = rng.below(other.size());
+          std::size_t len = std::min(other.size() - from, max_input_size - pos);
+          data.resize(std::max(data.size(), pos + len));
+          std::copy(other.begin() + from, other.begin() + from + len, data.begin() + pos);
+          break;
+        }
+        }
+      }
+    }
+
+    // Run ‘nexecs’ mutated inputs of ‘ncycles’ cycles each.  Inputs that reach
+    // new coverage join the corpus; for each nonzero exit code, the input that
+    // fails earliest is saved to ‘prefix’-‘exit code’.bin, for replaying with
+    // SIM_FUZZ_REPLAY.
+    template<typename simulator, typename... Args>
+    static _unused int main(ull ncycles, ull nexecs, const std::string& prefix,
+                            const Args&... args) {
+      struct failure {
+        std::uint_fast64_t cycle_id;
+        std::string fpath;
+      };
+
+      xoshiro256ss rng{};
+      rng.seed(random_seed);
+
+      std::vector<std::uint8_t> seen(npoints<simulator>(), 0);
+      std::vector<input_data> corpus{input_data{}};
+      std::map<int, failure> failures;
+
+      run_one<simulator>(corpus[0], ncycles, args...);
+      merge_coverage(seen);
+
+      auto start = std::chrono::steady_clock::now();
+      for (ull exec = 1; exec <= nexecs; exec++) {
+        input_data data = corpus[rng.below(corpus.size())];
+        mutate(data, corpus, rng);
+
+        sim_metadata meta = run_one<simulator>(data, ncycles, args...);
+        if (merge_coverage(seen) > 0)
+          corpus.push_back(data);
+
+        auto known = failures.find(meta.exit_code);
+        if (meta.exit_code != 0 &&
+            (known == failures.end() || meta.cycle_id < known->second.cycle_id)) {
+          std::string fpath = prefix + "-" + std::to_string(meta.exit_code) + ".bin";
+          std::ofstream(fpath, std::ios::binary)
+            .write(reinterpret_cast<const char*>(data.data()),
+                   static_cast<std::streamsize>(data.size()));
+          failures[meta.exit_code] = failure{meta.cycle_id, fpath};
+        }
+
+        if ((exec & (exec - 1)) == 0 || exec == nexecs) {
+          auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+          std::size_t covered = 0;
+          for (auto buckets : seen)
+            covered += buckets != 0;
+          std::cerr << "fuzz: " << exec << " execs ("
+                    << static_cast<ull>(exec / std::max(elapsed.count(), 1e-9)) << "/s), "
+                    << covered << "/" << seen.size() << " points covered, "
+                    << corpus.size() << " inputs in corpus, "
+                    << failures.size() << " distinct failures" << std::endl;
+        }
+      }
+
+      for (auto& f : failures)
+        std::cerr << "  exit code " << f.first << " at cycle " << f.second.cycle_id
+                  << ": rerun with SIM_FUZZ_REPLAY=" << f.second.fpath << std::endl;
+
+      return failures.empty() ? 0 : 1;
+    }
+
+    // Run a single saved input and report the final state
+    template<typename simulator, typename... Args>
+    static _unused int replay(ull ncycles, const std::string& fpath, const Args&... args) {
+      std::ifstream in(fpath, std::ios::binary);
+      if (!in) {
+        std::cerr << "ERROR: could not open " << fpath << std::endl;
+        exit(1);
+      }
+      input_data data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+      input = input_t{data.data(), data.size(), 0};
+      auto snapshot = simulator(args...).run(ncycles).snapshot();
+      return snapshot.report();
+    }
+  }
+#endif
+
   /// ## Command-line interface
 
   struct params {
     ull ncycles = 1000;
+    std::string load_state_fpath = {};
+    std::string save_state_fpath = {};
 #ifdef SIM_TRACE
     std::string vcd_fpath = {};
 #endif
+#ifdef SIM_SWEEP
+    ull nseeds = 1000;
+    unsigned nthreads = std::thread::hardware_concurrency();
+#endif
+#ifdef SIM_FUZZ
+    ull nexecs = 100000;
+    std::string fuzz_prefix = {};
+    std::string fuzz_replay_fpath = {};
+#endif
 
     static params of_cli(int argc, char **argv) {
       params parsed{};
@@ -1319,6 +1985,14 @@ namespace cuttlesim {
       if (argc > 1)
         parsed.ncycles = std::stoull(argv[1]);
 
+      // Register states (single-timestep VCD files) to start from and to
+      // save at the end of the simulation; these are compatible with
+      // Verilator models using ‘+load_state=’ and ‘+save_state=’.
+      if (char* fpath = std::getenv("SIM_LOAD_STATE"))
+        parsed.load_state_fpath = fpath;
+      if (char* fpath = std::getenv("SIM_SAVE_STATE"))
+        parsed.save_state_fpath = fpath;
+
 #ifdef SIM_TRACE
       if (argc > 2)
         parsed.vcd_fpath = argv[2];
@@ -1326,10 +2000,58 @@ namespace cuttlesim {
         parsed.vcd_fpath = std::string(argv[0]) + ".vcd";
 #endif
 
+#ifdef SIM_SWEEP
+      if (argc > 2)
+        parsed.nseeds = std::stoull(argv[2]);
+      if (argc > 3)
+        parsed.nthreads = static_cast<unsigned>(std::stoul(argv[3]));
+#endif
+
+#ifdef SIM_FUZZ
+      if (argc > 2)
+        parsed.nexecs = std::stoull(argv[2]);
+      parsed.fuzz_prefix = std::string(argv[0]) + ".failure";
+      if (char* fpath = std::getenv("SIM_FUZZ_REPLAY"))
+        parsed.fuzz_replay_fpath = fpath;
+#endif
+
       return parsed;
     }
   };
 
+  template<typename simulator, typename... Args>
+  _unused _flatten static __attribute__((noinline)) typename simulator::snapshot_t
+  init_and_resume(const params& params, Args&&... args) {
+    simulator sim(std::forward<Args>(args)...);
+    std::ifstream vcd(params.load_state_fpath);
+    if (!vcd) {
+      std::cerr << "ERROR: could not open " << params.load_state_fpath << std::endl;
+      exit(1);
+    }
+    sim.load_state(vcd);
+
+#if defined(SIM_TRACE) && defined(SIM_RANDOMIZED)
+    return sim.trace_randomized(params.vcd_fpath, params.ncycles).snapshot();
+#elif defined(SIM_TRACE)
+    return sim.trace(params.vcd_fpath, params.ncycles).snapshot();
+#elif defined(SIM_RANDOMIZED)
+    return sim.run_randomized(params.ncycles).snapshot();
+#elif defined(SIM_PARALLEL)
+    return sim.run_parallel(params.ncycles).snapshot();
+#else
+    return sim.run(params.ncycles).snapshot();
+#endif
+  }
+
+  template<typename snapshot_t>
+  static _unused int conclude(const params& params, snapshot_t& snapshot) {
+    if (!params.save_state_fpath.empty()) {
+      std::ofstream vcd(params.save_state_fpath);
+      snapshot.save_state(vcd);
+    }
+    return snapshot.report();
+  }
+
   /// ## int main()
 
   template<typename simulator, typename... Args>
@@ -1343,6 +2065,18 @@ namespace cuttlesim {
     // parameter instead yielded the same speedup, plus an extra 20% speedup in
     // GCC thanks to inlining magic.
 
+#if defined(SIM_SWEEP)
+    return sweep<simulator>(params.ncycles, params.nseeds, params.nthreads, args...);
+#elif defined(SIM_FUZZ)
+    if (!params.fuzz_replay_fpath.empty())
+      return fuzz::replay<simulator>(params.ncycles, params.fuzz_replay_fpath, args...);
+    return fuzz::main<simulator>(params.ncycles, params.nexecs, params.fuzz_prefix, args...);
+#else
+    if (!params.load_state_fpath.empty()) {
+      auto snapshot = init_and_resume<simulator>(params, std::forward<Args>(args)...);
+      return conclude(params, snapshot);
+    }
+
 #if defined(SIM_TRACE) && defined(SIM_RANDOMIZED)
     auto snapshot = init_and_trace_randomized<simulator>(
       params.vcd_fpath, params.ncycles, std::forward<Args>(args)...);
@@ -1352,12 +2086,16 @@ namespace cuttlesim {
 #elif defined(SIM_RANDOMIZED)
     auto snapshot = init_and_run_randomized<simulator>(
       params.ncycles, std::forward<Args>(args)...);
+#elif defined(SIM_PARALLEL)
+    auto snapshot = init_and_run_parallel<simulator>(
+      params.ncycles, std::forward<Args>(args)...);
 #else
     auto snapshot = init_and_run<simulator>(
       params.ncycles, std::forward<Args>(args)...);
 #endif
 
-    return snapshot.report();
+    return conclude(params, snapshot);
+#endif
   }
 #endif
 } // namespace cuttlesim
@@ -1385,19 +2123,69 @@ namespace cuttlesim {
 #define DEF_FN(fname, ...) \
   bool PASTE_EXPANDED_3(fn, RULE_NAME, fname)(__VA_ARGS__) noexcept
 
+// Shared functions don't depend on the calling rule (they can't fail and don't
+// access registers), so they are defined once per model and return directly.
+#define DECL_SHARED_FN(fname, ...) \
+  using PASTE_ARGS_2(ti_sfn, fname) = __VA_ARGS__;
+
+#define DEF_SHARED_FN(fname, ...) \
+  PASTE_ARGS_2(ti_sfn, fname) PASTE_ARGS_2(sfn, fname)(__VA_ARGS__) noexcept
+
 #define RULE_DECL(ret_type, name, rl) \
   _inline ret_type PASTE_ARGS_2(name, rl)() noexcept
 
+// Failure paths are cold: reset functions are kept out of line (so all failure
+// sites of a rule share one copy of the reset code, away from the hot path),
+// and fail checks are laid out as not-taken branches.  Define SIM_HOT_FAILURES
+// to inline them instead (useful to measure the effect of this layout).
+#ifdef SIM_HOT_FAILURES
+#define _cold _inline
+#define _fails(b) (b)
+#else
+#define _cold __attribute__((cold, noinline))
+#define _fails(b) __builtin_expect(!!(b), 0)
+#endif
+
 #define DEF_RULE(rl) RULE_DECL(bool, rule, rl)
-#define DEF_RESET(rl) RULE_DECL(void, reset, rl)
+#define DEF_RESET(rl) \
+  _cold void PASTE_ARGS_2(reset, rl)() noexcept
 #define DEF_COMMIT(rl) RULE_DECL(void, commit, rl)
 
+/// ## Coverage
+
+#ifdef SIM_FUZZ
+#define COVER(id) \
+  { cuttlesim::fuzz::coverage[(id) % cuttlesim::fuzz::coverage_map_size]++; }
+#else
+#define COVER(id)
+#endif
+
+/// ## Memoization
+
+// Memoized functions are shared functions whose results are cached (see
+// ‘cuttlesim::memo_cache’) when compiling with SIM_MEMOIZE.
+#ifdef SIM_MEMOIZE
+#define DECL_MEMO(fname) \
+  cuttlesim::memo_cache<PASTE_ARGS_2(ti_sfn, fname)> PASTE_ARGS_2(memo, fname){#fname};
+#define MEMO_LOOKUP(fname, key) \
+  const std::uint64_t _memo_key = (key); \
+  { auto _cached = PASTE_ARGS_2(memo, fname).find(_memo_key); \
+    if (_cached) return *_cached; }
+#define MEMO_RETURN(fname, val) \
+  return PASTE_ARGS_2(memo, fname).store(_memo_key, (val))
+#else
+#define DECL_MEMO(fname)
+#define MEMO_LOOKUP(fname, key)
+#define MEMO_RETURN(fname, val) \
+  return (val)
+#endif
+
 /// ## Read, write, and fail
 
 #define FAIL() \
   { PASTE_EXPANDED_2(reset, RULE_NAME)(); return false; }
 #define FAIL_UNLESS(can_fire) \
-  { if (!(can_fire)) { FAIL(); }  }
+  { if (_fails(!(can_fire))) { FAIL(); }  }
 #define READ(read_fn, reg, source) \
   ({ decltype(source.reg) _tmp; \
      FAIL_UNLESS(read_fn(&_tmp, source.reg, log.rwset.reg, Log.rwset.reg)); \
@@ -1418,11 +2206,25 @@ namespace cuttlesim {
   ({ PASTE_EXPANDED_3(ti_fn, RULE_NAME, fname) _tmp; \
      FAIL_UNLESS(PASTE_EXPANDED_3(fn, RULE_NAME, fname)(_tmp,##__VA_ARGS__)); \
      _tmp; })
+#define CALL_SHARED_FN(fname, ...) \
+  PASTE_ARGS_2(sfn, fname)(__VA_ARGS__)
 #define COMMIT() \
   { PASTE_EXPANDED_2(commit, RULE_NAME)(); return true; }
 
 #define FAIL_FAST() \
   { return false; }
+
+// Checks hoisted to the beginning of a rule: nothing needs to be reset yet.
+#define GUARD(cond) \
+  { if (_fails(!static_cast<bool>(cond))) { FAIL_FAST(); } }
+#define GUARD_READ0(reg) \
+  GUARD(log.rwset.reg.may_read0(Log.rwset.reg))
+#define GUARD_READ1(reg) \
+  GUARD(log.rwset.reg.may_read1(Log.rwset.reg))
+#define GUARD_WRITE0(reg) \
+  GUARD(log.rwset.reg.may_write0())
+#define GUARD_WRITE1(reg) \
+  GUARD(log.rwset.reg.may_write1())
 #define READ0_FAST(reg) \
   Log.state.reg
 #define READ1_FAST(reg) \
@@ -1432,12 +2234,47 @@ namespace cuttlesim {
 #define WRITE1_FAST(reg, ...) \
   log.state.reg = (__VA_ARGS__)
 
+// Log-free models (see ‘log_free’ in cpp.ml) update a single state in place.
+#define READ0_LF(reg) \
+  Log.state.reg
+#define READ1_LF(reg) \
+  Log.state.reg
+#define WRITE0_LF(reg, ...) \
+  Log.state.reg = (__VA_ARGS__)
+#define WRITE1_LF(reg, ...) \
+  Log.state.reg = (__VA_ARGS__)
+#define CALL_FN_LF(fname, ...) \
+  ({ PASTE_EXPANDED_3(ti_fn, RULE_NAME, fname) _tmp; \
+     if (_fails(!PASTE_EXPANDED_3(fn, RULE_NAME, fname)(_tmp,##__VA_ARGS__))) { FAIL_FAST(); } \
+     _tmp; })
+#define COMMIT_LF() \
+  { return true; }
+
+// Indexed accesses to registers of the same type (e.g. register files), through
+// tables of pointers to members of ‘state_t’ (see ‘indexed_access’ in cpp.ml).
+#define READ0_FAST_AT(regs, idx) \
+  (Log.state.*regs[idx])
+#define READ1_FAST_AT(regs, idx) \
+  (log.state.*regs[idx])
+#define WRITE0_FAST_AT(regs, idx, ...) \
+  (log.state.*regs[idx]) = (__VA_ARGS__)
+#define WRITE1_FAST_AT(regs, idx, ...) \
+  (log.state.*regs[idx]) = (__VA_ARGS__)
+#define READ0_LF_AT(regs, idx) \
+  (Log.state.*regs[idx])
+#define READ1_LF_AT(regs, idx) \
+  (Log.state.*regs[idx])
+#define WRITE0_LF_AT(regs, idx, ...) \
+  (Log.state.*regs[idx]) = (__VA_ARGS__)
+#define WRITE1_LF_AT(regs, idx, ...) \
+  (Log.state.*regs[idx]) = (__VA_ARGS__)
+
 /// ## Alternative implementations of read, write, and fail
 
 #define FAIL_DL() \
   { dlog.apply(log, Log); return false; }
 #define FAIL_UNLESS_DL(can_fire) \
-  { if (!(can_fire)) { FAIL_DL(); } }
+  { if (_fails(!(can_fire))) { FAIL_DL(); } }
 #define READ_DL(read_fn, reg, source) \
   ({ dlog.push(reg_name_t::reg); \
      decltype(source.reg) _tmp; \
@@ -1460,7 +2297,7 @@ namespace cuttlesim {
 #define FAIL_DOL() \
   { dlog.apply(log, Log); return false; }
 #define FAIL_UNLESS_DOL(can_fire) \
-  { if (!(can_fire)) { FAIL_DOL(); } }
+  { if (_fails(!(can_fire))) { FAIL_DOL(); } }
 #define PUSH_DOL(reg) \
   dlog.push({ \
       offsetof(struct state_t, reg), sizeof(state_t::reg), \
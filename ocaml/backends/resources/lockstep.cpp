@@ -0,0 +1,20 @@
+/*! Default driver for lockstep comparisons of Cuttlesim and Verilator models !*/
+#include "__CUTTLEC_MODULE_NAME__.hpp"
+#include "lockstep.hpp"
+#include "V__CUTTLEC_MODULE_NAME__.h"
+
+// If your design uses external functions, copy their Cuttlesim definitions
+// here (see __CUTTLEC_MODULE_NAME__.cpp); Verilator definitions go through DPI,
+// as in __CUTTLEC_MODULE_NAME__.verilator.cpp.
+struct extfuns {};
+
+using cuttlesim_t = lockstep::cuttlesim_model<module___CUTTLEC_MODULE_NAME__<extfuns>>;
+using verilator_t = lockstep::verilator_model<V__CUTTLEC_MODULE_NAME__>;
+
+int main(int argc, char** argv) {
+  return lockstep::main<cuttlesim_t, verilator_t>(argc, argv, "__CUTTLEC_MODULE_NAME__");
+}
+
+// Local Variables:
+// flycheck-clang-include-path: ("/usr/share/verilator/include" "/usr/share/verilator/include/vltstd/")
+// End:
@@ -0,0 +1,339 @@
+/*! Lockstep differential testing of Cuttlesim and Verilator models !*/
+#include <algorithm> // For std::min
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef STATE_HANDOFF
+#define STATE_HANDOFF // For vpi_registers
+#endif
+
+#include "verilator.hpp"
+#include "verilated_save.h"
+
+// Both models are stepped in their own thread, and their register states are
+// compared every ‘period’ cycles.  On mismatch, both models are rewound to the
+// last checkpoint on which they agreed, and the first divergent cycle is
+// located by bisection.  Registers are matched by name; external functions are
+// not checkpointed, so they should be deterministic and free of side effects.
+// Both models must expose the same, non-empty set of registers.
+
+namespace lockstep {
+  using ull = unsigned long long int;
+
+  // Register name → value, as a binary string without leading zeros
+  using regs_t = std::map<std::string, std::string>;
+
+  static std::string normalize(const char* val) {
+    if (*val == 'b')
+      val++;
+    while (*val == '0' && *(val + 1) != '\0')
+      val++;
+    return val;
+  }
+
+  struct status_t {
+    regs_t regs;
+    bool finished;
+  };
+
+  /// # Simulators
+
+  template<typename model_t>
+  class cuttlesim_model final : public model_t {
+    using state_t = typename model_t::state_t;
+    using model_t::Log;
+    using model_t::meta;
+
+    state_t checkpoint_state;
+    cuttlesim::sim_metadata checkpoint_meta;
+
+  public:
+    void step(ull ncycles) {
+      this->run(ncycles);
+    }
+
+    void save() {
+      checkpoint_state = Log.state;
+      checkpoint_meta = meta;
+    }
+
+    void restore() {
+      this->set_state(checkpoint_state);
+      meta = checkpoint_meta;
+    }
+
+    status_t status() const {
+      status_t st{{}, meta.finished};
+      std::stringstream vcd;
+      Log.state.vcd_dumpvars(meta.cycle_id, vcd, Log.state, true);
+
+      std::string name{}, val{};
+      std::uint_fast64_t cycle_id;
+      while (cuttlesim::vcd::readvar(vcd, cycle_id, name, val))
+        st.regs[name] = normalize(val.c_str());
+      return st;
+    }
+
+    explicit cuttlesim_model(const std::string& /*modname*/)
+      : model_t{}, checkpoint_state{Log.state}, checkpoint_meta{meta} {}
+  };
+
+  // Requires Verilator's ‘--vpi’ (to read registers by name) and ‘--savable’
+  // (for checkpoints) flags.
+  template<typename Dut>
+  class verilator_model final : public KoikaToplevel<Dut> {
+    using Toplevel<Dut>::dut;
+    using Toplevel<Dut>::time;
+
+    std::string checkpoint_fpath;
+    vpi_registers registers;
+
+  public:
+    void step(ull ncycles) {
+      for (ull cid = 0; !Verilated::gotFinish() && cid < ncycles; cid++) {
+        this->cycle();
+      }
+    }
+
+    void save() {
+      VerilatedSave os;
+      os.open(checkpoint_fpath.c_str());
+      os << time << dut;
+    }
+
+    void restore() {
+      VerilatedRestore is;
+      is.open(checkpoint_fpath.c_str());
+      is >> time >> dut;
+    }
+
+    status_t status() {
+      status_t st{{}, Verilated::gotFinish()};
+      for (auto& reg : registers.read())
+        st.regs[reg.first] = normalize(reg.second.c_str());
+      return st;
+    }
+
+    explicit verilator_model(const std::string& modname)
+      : KoikaToplevel<Dut>{}, checkpoint_fpath{modname + ".lockstep.ckpt"},
+        registers{"TOP." + modname} {
+      Toplevel<Dut>::reset();
+    }
+  };
+
+  /// # Threads
+
+  // A single-slot channel between two threads
+  template<typename T>
+  class mailbox {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool full;
+    T contents;
+
+  public:
+    void put(T val) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        contents = std::move(val);
+        full = true;
+      }
+      cv.notify_one();
+    }
+
+    T take() {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return full; });
+      full = false;
+      return std::move(contents);
+    }
+
+    mailbox() : mutex{}, cv{}, full{false}, contents{} {}
+  };
+
+  enum class command { step, save, restore, stop };
+
+  // Owns a simulator and runs commands on it in a dedicated thread (Verilator
+  // models must always be evaluated from the same thread).  Each command is
+  // answered with the simulator's status.
+  template<typename model_t>
+  class worker {
+    struct request {
+      command cmd;
+      ull ncycles;
+    };
+
+    mailbox<request> requests;
+    mailbox<status_t> replies;
+    std::thread thread;
+
+    void loop(std::string modname) {
+      model_t model{modname};
+      for (;;) {
+        request rq = requests.take();
+        switch (rq.cmd) {
+        case command::step:
+          model.step(rq.ncycles);
+          break;
+        case command::save:
+          model.save();
+          break;
+        case command::restore:
+          model.restore();
+          break;
+        case command::stop:
+          replies.put(status_t{});
+          return;
+        }
+        replies.put(model.status());
+      }
+    }
+
+  public:
+    void post(command cmd, ull ncycles = 0) {
+      requests.put(request{cmd, ncycles});
+    }
+
+    status_t wait() {
+      return replies.take();
+    }
+
+    explicit worker(const std::string& modname)
+      : requests{}, replies{}, thread{&worker::loop, this, modname} {}
+
+    ~worker() {
+      post(command::stop);
+      wait();
+      thread.join();
+    }
+  };
+
+  /// # Comparison
+
+  struct comparison {
+    status_t cuttlesim, verilator;
+
+    // A register that exists on only one side counts as a disagreement.
+    bool agree() const {
+      return cuttlesim.regs == verilator.regs;
+    }
+
+    // Registers that exist on only one side (this happens when VPI finds no
+    // handles, or when a register is named differently by the two backends)
+    std::vector<std::string> unmatched() const {
+      std::vector<std::string> names{};
+      for (auto& reg : cuttlesim.regs)
+        if (verilator.regs.count(reg.first) == 0)
+          names.push_back("cuttlesim: " + reg.first);
+      for (auto& reg : verilator.regs)
+        if (cuttlesim.regs.count(reg.first) == 0)
+          names.push_back("verilator: " + reg.first);
+      return names;
+    }
+
+    bool finished() const {
+      return cuttlesim.finished || verilator.finished;
+    }
+  };
+
+  template<typename cuttlesim_t, typename verilator_t>
+  class harness {
+    worker<cuttlesim_t> csim;
+    worker<verilator_t> vsim;
+
+    comparison both(command cmd, ull ncycles = 0) {
+      csim.post(cmd, ncycles);
+      vsim.post(cmd, ncycles);
+      return comparison{csim.wait(), vsim.wait()};
+    }
+
+    static void report(ull cycle_id, const comparison& before, const comparison& after) {
+      std::cerr << "lockstep: first divergence at cycle " << cycle_id << std::endl;
+      for (auto& reg : after.cuttlesim.regs) {
+        auto other = after.verilator.regs.find(reg.first);
+        if (other == after.verilator.regs.end() || other->second == reg.second)
+          continue;
+        std::cerr << "  " << reg.first
+                  << ": cuttlesim = b" << reg.second
+                  << ", verilator = b" << other->second
+                  << " (previously b" << before.cuttlesim.regs.at(reg.first) << ")"
+                  << std::endl;
+      }
+    }
+
+  public:
+    // Returns 0 if the models agree for ‘ncycles’ cycles.
+    int run(ull ncycles, ull period) {
+      period = std::max(period, 1ull);
+
+      // ‘lo’ is the cycle of the last checkpoint (on which both models agree)
+      ull lo = 0;
+      comparison cmp = both(command::save);
+      auto unmatched = cmp.unmatched();
+      if (cmp.cuttlesim.regs.empty() || !unmatched.empty()) {
+        std::cerr << "lockstep: the two models do not expose the same registers";
+        if (cmp.cuttlesim.regs.empty() && cmp.verilator.regs.empty())
+          std::cerr << " (no registers found)";
+        std::cerr << std::endl;
+        for (auto& name : unmatched)
+          std::cerr << "  only in " << name << std::endl;
+        return 2;
+      }
+      if (!cmp.agree()) {
+        report(0, cmp, cmp);
+        return 1;
+      }
+
+      while (lo < ncycles && !cmp.finished()) {
+        ull hi = lo + std::min(period, ncycles - lo);
+        cmp = both(command::step, hi - lo);
+        if (cmp.agree()) {
+          both(command::save);
+          lo = hi;
+          continue;
+        }
+
+        while (hi - lo > 1) {
+          ull mid = lo + (hi - lo) / 2;
+          both(command::restore);
+          if (both(command::step, mid - lo).agree()) {
+            both(command::save);
+            lo = mid;
+          } else {
+            hi = mid;
+          }
+        }
+
+        comparison before = both(command::restore);
+        report(hi, before, both(command::step, 1));
+        return 1;
+      }
+
+      std::cerr << "lockstep: no divergence in " << lo << " cycles" << std::endl;
+      return 0;
+    }
+
+    explicit harness(const std::string& modname) : csim{modname}, vsim{modname} {}
+  };
+
+  template<typename cuttlesim_t, typename verilator_t>
+  static int main(int argc, char** argv, const std::string& modname) {
+    Verilated::commandArgs(argc, argv);
+    cli_arguments args(argc, argv);
+
+    // The second positional argument is the comparison period
+    ull period = args.vcd_fpath ? std::strtoull(args.vcd_fpath, nullptr, 10) : 1000;
+    return harness<cuttlesim_t, verilator_t>{modname}.run(args.ncycles, period);
+  }
+}
+
+// Local Variables:
+// flycheck-clang-include-path: ("/usr/share/verilator/include" "/usr/share/verilator/include/vltstd/")
+// End:
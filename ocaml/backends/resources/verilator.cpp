@@ -7,7 +7,7 @@
 // above and add your definitions here.
 
 int main(int argc, char** argv) {
-  return _main<KoikaToplevel<V__CUTTLEC_MODULE_NAME__>>(argc, argv);
+  return _main<KoikaToplevel<V__CUTTLEC_MODULE_NAME__>>(argc, argv, "TOP.__CUTTLEC_MODULE_NAME__");
 }
 
 // Local Variables:
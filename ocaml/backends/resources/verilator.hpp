@@ -1,13 +1,117 @@
 /*! Preamble shared by all Kôika programs compiled to C++ using Verilator !*/
 #include <cstdint>
+#include <cstring> // For strncmp in cli_arguments
 #include "verilated.h"
 
 #ifdef TRACE
 #include "verilated_vcd_c.h"
 #endif
 
+#ifdef STATE_HANDOFF
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "verilated_vpi.h"
+#endif
+
 #define TIMESTEP 5
 
+#ifdef STATE_HANDOFF
+// Access to the registers of a Verilated module by name, through VPI.  This
+// requires Verilator's ‘--vpi’ and ‘--public-flat-rw’ flags (both are in the
+// Makefile's VERILATOR_HANDOFF_FLAGS).  Register states are exchanged as single-timestep VCD
+// files, in the format used by Cuttlesim's ‘save_state’ and ‘load_state’.
+class vpi_registers {
+  std::string scope;
+  std::map<std::string, vpiHandle> handles;
+
+public:
+  // Register values are binary strings
+  std::map<std::string, std::string> read() {
+    std::map<std::string, std::string> values{};
+    s_vpi_value val{};
+    val.format = vpiBinStrVal;
+    for (auto& h : handles) {
+      vpi_get_value(h.second, &val);
+      values[h.first] = val.value.str;
+    }
+    return values;
+  }
+
+  bool write(const std::string& name, const std::string& bin) {
+    auto h = handles.find(name);
+    if (h == handles.end())
+      return false;
+    s_vpi_value val{};
+    val.format = vpiBinStrVal;
+    val.value.str = const_cast<PLI_BYTE8*>(bin.c_str());
+    vpi_put_value(h->second, &val, nullptr, vpiNoDelay);
+    return true;
+  }
+
+  void save(std::ostream& os, std::uint64_t cycle_id) {
+    std::string module;
+    std::istringstream modules(scope);
+    os << "$timescale 1 ns $end" << std::endl;
+    while (std::getline(modules, module, '.'))
+      os << "$scope module " << module << " $end" << std::endl;
+    for (auto& h : handles) {
+      int sz = vpi_get(vpiSize, h.second);
+      os << "$var wire " << sz << " " << h.first << " " << h.first;
+      if (sz > 1)
+        os << " [" << sz - 1 << ":0]";
+      os << " $end" << std::endl;
+    }
+    modules.clear();
+    modules.seekg(0);
+    while (std::getline(modules, module, '.'))
+      os << "$upscope $end" << std::endl;
+    os << "$enddefinitions $end" << std::endl;
+    os << "$dumpvars" << std::endl;
+    os << "#" << cycle_id << std::endl;
+    for (auto& val : read())
+      os << "b" << val.second << " " << val.first << std::endl;
+  }
+
+  // Returns the cycle number recorded in the VCD file
+  std::uint64_t load(std::istream& is) {
+    std::uint64_t cycle_id = 0;
+    std::string line{};
+    while (std::getline(is, line) && line.rfind("$dumpvars", 0) != 0)
+      continue;
+    while (std::getline(is, line)) {
+      std::istringstream ls(line);
+      if (line.empty()) {
+        continue;
+      } else if (line[0] == '#') {
+        ls.ignore(1, '#');
+        ls >> cycle_id;
+      } else {
+        std::string val{}, name{};
+        ls >> val >> name;
+        if (!write(name, val[0] == 'b' ? val.substr(1) : val))
+          std::cerr << "WARNING: unknown register " << name << std::endl;
+      }
+    }
+    return cycle_id;
+  }
+
+  explicit vpi_registers(const std::string& scope) : scope{scope}, handles{} {
+    vpiHandle mod = vpi_handle_by_name(const_cast<PLI_BYTE8*>(scope.c_str()), nullptr);
+    vpiHandle it = mod ? vpi_iterate(vpiReg, mod) : nullptr;
+    while (vpiHandle reg = it ? vpi_scan(it) : nullptr) {
+      handles[vpi_get_str(vpiName, reg)] = reg;
+    }
+
+    if (handles.empty()) {
+      std::cerr << "WARNING: no public registers found in " << scope << std::endl;
+    }
+  }
+};
+#endif
+
 template<typename Dut>
 class Toplevel {
 protected:
@@ -18,6 +122,10 @@ protected:
   VerilatedVcdC* tfp{};
 #endif
 
+  std::uint64_t cycle_id() const {
+    return time / (2 * TIMESTEP) - 1;
+  }
+
   virtual void clock(bool /*up*/) = 0;
   virtual void reset(bool /*up*/) = 0;
 
@@ -49,11 +157,42 @@ protected:
   }
 
 public:
+  // Set these to start from a saved state, or to save the final state
+  const char* load_state_fpath{};
+  const char* save_state_fpath{};
+  // Scope of the registers (e.g. TOP.collatz), needed to load and save states
+  const char* scope{};
+
+#ifdef STATE_HANDOFF
+  void load_state(const char* fpath) {
+    std::ifstream vcd(fpath);
+    if (!vcd) {
+      std::cerr << "ERROR: could not open " << fpath << std::endl;
+      exit(1);
+    }
+    time = (vpi_registers{scope}.load(vcd) + 1) * 2 * TIMESTEP;
+    dut.eval();
+  }
+
+  void save_state(const char* fpath) {
+    std::ofstream vcd(fpath);
+    vpi_registers{scope}.save(vcd, cycle_id());
+  }
+#endif
+
   void run(std::uint_fast64_t ncycles) {
     reset();
+#ifdef STATE_HANDOFF
+    if (load_state_fpath)
+      load_state(load_state_fpath);
+#endif
     for (std::uint_fast64_t cid = 0; !Verilated::gotFinish() && cid < ncycles; cid++) {
       cycle();
     }
+#ifdef STATE_HANDOFF
+    if (save_state_fpath)
+      save_state(save_state_fpath);
+#endif
   }
 
 #ifdef TRACE
@@ -95,10 +234,23 @@ public:
 struct cli_arguments {
   char* vcd_fpath;
   std::uint64_t ncycles;
+  const char* load_state_fpath;
+  const char* save_state_fpath;
+
+  static const char* plusarg(const char* arg, const char* name) {
+    std::size_t len = std::strlen(name);
+    return std::strncmp(arg, name, len) == 0 ? arg + len : nullptr;
+  }
 
-  cli_arguments(int argc, char** argv) : vcd_fpath(nullptr), ncycles(UINT64_MAX) {
+  cli_arguments(int argc, char** argv)
+    : vcd_fpath(nullptr), ncycles(UINT64_MAX),
+      load_state_fpath(nullptr), save_state_fpath(nullptr) {
     int offset = 1;
     while (offset < argc && argv[offset][0] == '+') {
+      if (const char* fpath = plusarg(argv[offset], "+load_state="))
+        load_state_fpath = fpath;
+      if (const char* fpath = plusarg(argv[offset], "+save_state="))
+        save_state_fpath = fpath;
       offset++;
     }
 
@@ -113,11 +265,23 @@ struct cli_arguments {
 };
 
 template<typename Top>
-int _main(int argc, char** argv) {
+int _main(int argc, char** argv, const char* scope = nullptr) {
   Verilated::commandArgs(argc, argv);
 
   cli_arguments args(argc, argv);
 
+  if ((args.load_state_fpath || args.save_state_fpath) && !scope) {
+    printf("Loading and saving states requires a scope (see _main)\n");
+    return 1;
+  }
+
+#ifndef STATE_HANDOFF
+  if (args.load_state_fpath || args.save_state_fpath) {
+    printf("Loading and saving states requires VERILATOR_HANDOFF_FLAGS (see the handoff target)\n");
+    return 1;
+  }
+#endif
+
 #ifdef TRACE
   if (!args.vcd_fpath) {
     printf("Usage: %s ncycles vcd_fname\n", argv[0]);
@@ -126,6 +290,9 @@ int _main(int argc, char** argv) {
 #endif
 
   Top toplevel{};
+  toplevel.load_state_fpath = args.load_state_fpath;
+  toplevel.save_state_fpath = args.save_state_fpath;
+  toplevel.scope = scope;
 
 #ifdef TRACE
   toplevel.trace(args.ncycles, args.vcd_fpath);
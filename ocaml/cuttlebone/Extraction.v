@@ -16,7 +16,7 @@ Extraction "extr.ml"
            FiniteType.FiniteType Member.mem Member.mmap
            PeanoNat.Nat.log2_up
            IndexUtils.List_nth
-           Environments.ContextEnv Environments.to_list
+           Environments.ContextEnv Environments.to_list Environments.cmapv
            Vect.vect_to_list Vect.vect_of_list Vect.Bits.to_nat Vect.index_to_nat Vect.vect_zip
            Syntax.scheduler
            Desugaring.desugar_action
@@ -251,6 +251,184 @@ module Util = struct
     | Some tau, Some v -> Some (value_of_extr_value tau v)
     | _, _ -> None
 
+  (* [true] if evaluating [a] has no effect (no reads, writes, assignments,
+     failures, calls, or displays), so that [a] can be removed if its value is
+     not used *)
+  let rec is_effect_free = function
+    | Extr.Var _ | Extr.Const _ -> true
+    | Extr.Unop (_, Extr.PrimTyped.Display _, _) -> false
+    | Extr.Unop (_, _, a) | Extr.APos (_, _, _, a) -> is_effect_free a
+    | Extr.Binop (_, _, a1, a2) -> is_effect_free a1 && is_effect_free a2
+    | _ -> false
+
+  (* Simplify a typed action before it is compiled to C++: fold primitive
+     applications whose arguments are constants, prune conditionals on
+     constants, drop effect-free statements from sequences, and eliminate
+     redundant let-bindings:
+
+     - Copy propagation: in [let y := x in body] and [let y := c in body] (with
+       [c] a scalar constant), uses of [y] in [body] refer to [x] or [c]
+       directly, so that constants reach the primitives that use them.
+     - Common subexpression elimination: [let y := e] reuses an enclosing
+       binding [let x := e] of the same effect-free expression.
+
+     Both only apply to variables that are bound once and never assigned
+     (‘stable’), so that equal names denote equal values throughout their scope;
+     the bindings that this makes dead are removed by the C++ backend.
+     Internal function bodies are simplified separately, since their variables
+     are distinct from the caller's.  This never removes a read, since reads
+     contribute to the rule's log. *)
+  let simplify_action a =
+    let rec strip = function
+      | Extr.APos (_, _, _, a) -> strip a
+      | a -> a in
+    let is_const a = match strip a with
+      | Extr.Const _ -> true
+      | _ -> false in
+    let fold sg a =
+      match Extr.action_type a, Extr.interp_arithmetic a with
+      | Some tau, Some cst -> Extr.Const (sg, tau, cst)
+      | _, _ -> a in
+
+    (* Variables bound at most once (counting the signature [sg] that [a] is
+       typed in) and never assigned in [a], not counting the bodies of internal
+       functions *)
+    let stable_vars sg a =
+      let nbinds = Hashtbl.create 16 and assigned = Hashtbl.create 16 in
+      let count v = match Hashtbl.find_opt nbinds v with Some n -> n | None -> 0 in
+      List.iter (fun (v, _) -> Hashtbl.replace nbinds v (count v + 1)) sg;
+      let rec walk = function
+        | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> ()
+        | Extr.Assign (_, v, _, _, a) -> Hashtbl.replace assigned v (); walk a
+        | Extr.Write (_, _, _, a) | Extr.Unop (_, _, a)
+        | Extr.ExternalCall (_, _, a) | Extr.APos (_, _, _, a) ->
+           walk a
+        | Extr.Bind (_, _, _, v, a1, a2) ->
+           Hashtbl.replace nbinds v (count v + 1);
+           walk a1; walk a2
+        | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2) -> walk a1; walk a2
+        | Extr.If (_, _, cond, tbr, fbr) -> walk cond; walk tbr; walk fbr
+        | Extr.InternalCall (_, _, _, argspec, rev_args, _) ->
+           Extr.cfoldl (fun _ arg () -> walk arg) argspec rev_args () in
+      walk a;
+      fun v -> not (Hashtbl.mem assigned v) && count v <= 1 in
+
+    (* A reference to the innermost binding of [v] in [sg] *)
+    let var_of_sig sg v =
+      let rec member = function
+        | [] -> None
+        | ((v', _) as k) :: sg' when v' = v -> Some (k, Extr.MemberHd (k, sg'))
+        | k' :: sg' ->
+           match member sg' with
+           | Some (k, m) -> Some (k, Extr.MemberTl (k, k', sg', m))
+           | None -> None in
+      match member sg with
+      | Some ((_, tau), m) -> Extr.Var (sg, v, tau, m)
+      | None -> assert false in
+
+    let rec vars_of acc a =
+      match strip a with
+      | Extr.Var (_, v, _, _) -> v :: acc
+      | Extr.Unop (_, _, a) -> vars_of acc a
+      | Extr.Binop (_, _, a1, a2) -> vars_of (vars_of acc a1) a2
+      | _ -> acc in
+
+    (* Structural equality, ignoring signatures and positions *)
+    let rec same_expr a1 a2 =
+      match strip a1, strip a2 with
+      | Extr.Var (_, v1, _, _), Extr.Var (_, v2, _, _) -> v1 = v2
+      | Extr.Const (_, tau1, c1), Extr.Const (_, tau2, c2) -> tau1 = tau2 && c1 = c2
+      | Extr.Unop (_, fn1, a1), Extr.Unop (_, fn2, a2) -> fn1 = fn2 && same_expr a1 a2
+      | Extr.Binop (_, fn1, a11, a12), Extr.Binop (_, fn2, a21, a22) ->
+         fn1 = fn2 && same_expr a11 a21 && same_expr a12 a22
+      | _, _ -> false in
+
+    (* Replace references to [v] in [a]; [repl sg] is the replacement in
+       signature [sg] *)
+    let rec subst v repl a =
+      let subst = subst v repl in
+      match a with
+      | Extr.Var (sg, v', _, _) when v' = v -> repl sg
+      | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> a
+      | Extr.Assign (sg, v', tau, m, ex) -> Extr.Assign (sg, v', tau, m, subst ex)
+      | Extr.Seq (sg, tau, a1, a2) -> Extr.Seq (sg, tau, subst a1, subst a2)
+      | Extr.Bind (sg, tau, tau', v', ex, body) ->
+         Extr.Bind (sg, tau, tau', v', subst ex, if v' = v then body else subst body)
+      | Extr.If (sg, tau, cond, tbr, fbr) ->
+         Extr.If (sg, tau, subst cond, subst tbr, subst fbr)
+      | Extr.Write (sg, port, reg, a) -> Extr.Write (sg, port, reg, subst a)
+      | Extr.Unop (sg, fn, a) -> Extr.Unop (sg, fn, subst a)
+      | Extr.Binop (sg, fn, a1, a2) -> Extr.Binop (sg, fn, subst a1, subst a2)
+      | Extr.ExternalCall (sg, fn, a) -> Extr.ExternalCall (sg, fn, subst a)
+      | Extr.InternalCall (sg, tau, fn, argspec, rev_args, body) ->
+         let rev_args = Extr.cmapv (fun _ arg -> subst arg) (List.rev argspec) rev_args in
+         Extr.InternalCall (sg, tau, fn, argspec, rev_args, body)
+      | Extr.APos (sg, tau, pos, a) -> Extr.APos (sg, tau, pos, subst a) in
+
+    let rec simplify_scope sg a =
+      let stable = stable_vars sg a in
+      let rec simplify avail a =
+        let recur = simplify avail in
+        match a with
+        | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> a
+        | Extr.Assign (sg, v, tau, m, ex) -> Extr.Assign (sg, v, tau, m, recur ex)
+        | Extr.Seq (sg, tau, a1, a2) ->
+           let a1 = recur a1 in
+           let a2 = recur a2 in
+           if is_effect_free a1 then a2 else Extr.Seq (sg, tau, a1, a2)
+        | Extr.Bind (sg, tau, tau', v, ex, body) ->
+           let ex = recur ex in
+           let reusable =
+             is_effect_free ex && stable v &&
+               List.for_all stable (vars_of [] ex) in
+           let ex =
+             match strip ex with
+             | Extr.Var _ | Extr.Const _ -> ex
+             | _ when is_effect_free ex ->
+                (match List.find_opt (fun (e, _) -> same_expr e ex) avail with
+                 | Some (_, x) -> var_of_sig sg x
+                 | None -> ex)
+             | _ -> ex in
+           let body =
+             match strip ex with
+             | Extr.Var (_, x, _, _) when stable v && stable x ->
+                subst v (fun sg -> var_of_sig sg x) body
+             | Extr.Const (_, ((Extr.Bits_t _ | Extr.Enum_t _) as tau), cst) when stable v ->
+                subst v (fun sg -> Extr.Const (sg, tau, cst)) body
+             | _ -> body in
+           let avail =
+             match strip ex with
+             | Extr.Var _ | Extr.Const _ -> avail
+             | _ when reusable -> (ex, v) :: avail
+             | _ -> avail in
+           Extr.Bind (sg, tau, tau', v, ex, simplify avail body)
+        | Extr.If (sg, tau, cond, tbr, fbr) ->
+           let cond = recur cond in
+           (match strip cond with
+            | Extr.Const (_, _, cst) ->
+               recur (if (array_of_vect 1 cst).(0) then tbr else fbr)
+            | _ -> Extr.If (sg, tau, cond, recur tbr, recur fbr))
+        | Extr.Write (sg, port, reg, a) -> Extr.Write (sg, port, reg, recur a)
+        | Extr.Unop (sg, (Extr.PrimTyped.Display _ as fn), a) ->
+           Extr.Unop (sg, fn, recur a)
+        | Extr.Unop (sg, fn, a) ->
+           let a = recur a in
+           let a' = Extr.Unop (sg, fn, a) in
+           if is_const a then fold sg a' else a'
+        | Extr.Binop (sg, fn, a1, a2) ->
+           let a1 = recur a1 in
+           let a2 = recur a2 in
+           let a' = Extr.Binop (sg, fn, a1, a2) in
+           if is_const a1 && is_const a2 then fold sg a' else a'
+        | Extr.ExternalCall (sg, fn, a) -> Extr.ExternalCall (sg, fn, recur a)
+        | Extr.InternalCall (sg, tau, fn, argspec, rev_args, body) ->
+           let rev_args = Extr.cmapv (fun _ arg -> recur arg) (List.rev argspec) rev_args in
+           Extr.InternalCall (sg, tau, fn, argspec, rev_args,
+                              simplify_scope (List.rev argspec) body)
+        | Extr.APos (sg, tau, pos, a) -> Extr.APos (sg, tau, pos, recur a) in
+      simplify [] a in
+    simplify_scope [] a
+
   let finiteType_of_list elements =
     let reg_indices = List.mapi (fun i x -> x, i) elements in
     (* Reverse so that deduplication removes high indices *)
@@ -265,6 +443,225 @@ module Util = struct
     List.to_seq l |> Seq.map (fun x -> (x, ()))
     |> Hashtbl.of_seq |> Hashtbl.to_seq_keys |> List.of_seq
 
+  (* The histories computed by [Extr.compute_register_histories] merge all
+     paths through each rule, including those that end in a [fail], and
+     consider all pairs of rules of the schedule; any uncertainty classifies a
+     register as a [Wire], [Register], or [EHR], and its reads and writes are
+     checked at run time.  [refine_register_kinds] proves more registers to be
+     [Value]s (conflict-free):
+
+     - The log left by a rule only contains the reads and writes of paths that
+       commit (a rule that fails, either explicitly or in a [Try] of the
+       scheduler, leaves nothing in the log).
+
+     - Two rules cannot conflict if they cannot both commit in the same cycle,
+       because they are guarded by incompatible conditions on the value of a
+       register at the beginning of the cycle (as in [guard(st.rd0 == S0)] and
+       [guard(st.rd0 == S1)], or [guard(valid.rd0)] and [guard(!valid.rd0)]).
+       The later rule's guards must be checked before any side effect, and
+       ‘st.rd0’ must return the initial value of ‘st’ in both rules: either no
+       earlier rule writes ‘st’, or ‘st’ remains checked (and ‘st.rd0’ fails
+       after such a write). *)
+  let refine_register_kinds (type reg_t rule_name_t)
+        (registers: reg_t list)
+        (reg_histories: rule_name_t -> reg_t -> Extr.register_history)
+        (annotated_rules: rule_name_t -> ('pos_t, 'var_t, 'fn_name_t, reg_t, 'ext_fn_t) Extr.annotated_rule)
+        (register_kinds: reg_t -> Extr.register_kind)
+        (scheduler: ('pos_t, rule_name_t) Extr.scheduler)
+      : reg_t -> Extr.register_kind =
+    let never t = t = Extr.TFalse in
+    let join t1 t2 = if t1 = t2 then t1 else Extr.TUnknown in
+    let empty = { Extr.hr0 = Extr.TFalse; Extr.hr1 = Extr.TFalse;
+                  Extr.hw0 = Extr.TFalse; Extr.hw1 = Extr.TFalse;
+                  Extr.hcf = Extr.TTrue } in
+
+    let rec is_fail = function
+      | Extr.Fail _ -> true
+      | Extr.APos (_, _, _, a) -> is_fail a
+      | _ -> false in
+    let rec strip = function
+      | Extr.APos (_, _, _, a) -> strip a
+      | a -> a in
+
+    (* Reads and writes of [reg] on paths of [a] that do not fail; [None] if all
+       paths fail. *)
+    let committed_history reg a =
+      let ( >>= ) h f = match h with None -> None | Some h -> f h in
+      let access (h: Extr.register_history) is_write port =
+        match is_write, port with
+        | false, Extr.P0 -> { h with Extr.hr0 = Extr.TTrue }
+        | false, Extr.P1 -> { h with Extr.hr1 = Extr.TTrue }
+        | true, Extr.P0 -> { h with Extr.hw0 = Extr.TTrue }
+        | true, Extr.P1 -> { h with Extr.hw1 = Extr.TTrue } in
+      let rec walk h = function
+        | Extr.Fail _ -> None
+        | Extr.Var _ | Extr.Const _ -> Some h
+        | Extr.Read (_, port, r) ->
+           Some (if r = reg then access h false port else h)
+        | Extr.Write (_, port, r, a) ->
+           walk h a >>= fun h -> Some (if r = reg then access h true port else h)
+        | Extr.Assign (_, _, _, _, a) | Extr.Unop (_, _, a)
+        | Extr.ExternalCall (_, _, a) | Extr.APos (_, _, _, a) ->
+           walk h a
+        | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+        | Extr.Bind (_, _, _, _, a1, a2) ->
+           walk h a1 >>= fun h -> walk h a2
+        | Extr.If (_, _, cond, tbr, fbr) ->
+           walk h cond >>= fun h ->
+           (match walk h tbr, walk h fbr with
+            | None, h | h, None -> h
+            | Some h1, Some h2 ->
+               Some { Extr.hr0 = join h1.Extr.hr0 h2.Extr.hr0;
+                      Extr.hr1 = join h1.Extr.hr1 h2.Extr.hr1;
+                      Extr.hw0 = join h1.Extr.hw0 h2.Extr.hw0;
+                      Extr.hw1 = join h1.Extr.hw1 h2.Extr.hw1;
+                      Extr.hcf = Extr.TTrue })
+        | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+           Extr.cfoldl (fun _ arg h -> h >>= fun h -> walk h arg)
+             argspec rev_args (Some h) >>= fun h -> walk h body in
+      match walk empty a with
+      | Some h -> h
+      | None -> empty in
+    let committed_histories = Hashtbl.create 64 in
+    let committed_history rl reg =
+      match Hashtbl.find_opt committed_histories (rl, reg) with
+      | Some h -> h
+      | None ->
+         let h = committed_history reg (annotated_rules rl) in
+         Hashtbl.add committed_histories (rl, reg) h;
+         h in
+
+    (* Conditions [(reg, v, eq)] meaning ‘[reg.rd0 == v] (if [eq]) or [reg.rd0
+       != v] (otherwise) holds whenever [a] commits’, checked before any side
+       effect in [a]. *)
+    let commit_conditions a =
+      let conds = ref [] in
+      let rec learn expected cond =
+        match strip cond with
+        | Extr.Read (_, Extr.P0, reg) ->
+           conds := (reg, Bits [| expected |], true) :: !conds
+        | Extr.Unop (_, Extr.PrimTyped.Bits1 (Extr.PrimTyped.Not _), a) ->
+           learn (not expected) a
+        | Extr.Binop (_, Extr.PrimTyped.Eq (_, negated), a1, a2) ->
+           (match strip a1, strip a2 with
+            | Extr.Read (_, Extr.P0, reg), Extr.Const (_, tau, cst)
+            | Extr.Const (_, tau, cst), Extr.Read (_, Extr.P0, reg) ->
+               conds := (reg, value_of_extr_value tau cst, expected <> negated) :: !conds
+            | _, _ -> ())
+        | _ -> () in
+      let rec has_effects = function
+        | Extr.Fail _ | Extr.Var _ | Extr.Const _ | Extr.Read _ -> false
+        | Extr.ExternalCall _ | Extr.Unop (_, Extr.PrimTyped.Display _, _) -> true
+        | Extr.Assign (_, _, _, _, a) | Extr.Write (_, _, _, a)
+        | Extr.Unop (_, _, a) | Extr.APos (_, _, _, a) ->
+           has_effects a
+        | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+        | Extr.Bind (_, _, _, _, a1, a2) ->
+           has_effects a1 || has_effects a2
+        | Extr.If (_, _, cond, tbr, fbr) ->
+           has_effects cond || has_effects tbr || has_effects fbr
+        | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+           Extr.cfoldl (fun _ arg eff -> eff || has_effects arg)
+             argspec rev_args (has_effects body) in
+      (* Like [hoisted_guards] in the C++ backend, [walk a] returns [false] if
+         execution might not reach the end of [a] without side effects. *)
+      let rec walk = function
+        | Extr.Fail _ -> false
+        | Extr.Var _ | Extr.Const _ | Extr.Read _ -> true
+        | Extr.ExternalCall (_, _, a) | Extr.Unop (_, Extr.PrimTyped.Display _, a) ->
+           ignore (walk a); false
+        | Extr.Assign (_, _, _, _, a) | Extr.Write (_, _, _, a)
+        | Extr.Unop (_, _, a) | Extr.APos (_, _, _, a) ->
+           walk a
+        | Extr.Seq (_, _, a1, a2) | Extr.Binop (_, _, a1, a2)
+        | Extr.Bind (_, _, _, _, a1, a2) ->
+           walk a1 && walk a2
+        | Extr.If (_, _, cond, tbr, fbr) ->
+           walk cond &&
+             if is_fail tbr then (learn false cond; walk fbr)
+             else if is_fail fbr then (learn true cond; walk tbr)
+             else not (has_effects tbr || has_effects fbr)
+        | Extr.InternalCall (_, _, _, argspec, rev_args, body) ->
+           Extr.cfoldl (fun _ arg ok -> ok && walk arg) argspec rev_args true
+           && walk body in
+      ignore (walk a);
+      !conds in
+
+    (* Each path is a list of rules with a flag indicating whether the rule
+       commits ([false] in the second branch of a [Try]). *)
+    let rec scheduler_paths = function
+      | Extr.Done -> [[]]
+      | Extr.Cons (rl, s) ->
+         List.map (fun path -> (rl, true) :: path) (scheduler_paths s)
+      | Extr.Try (rl, s1, s2) ->
+         List.map (fun path -> (rl, true) :: path) (scheduler_paths s1) @
+           List.map (fun path -> (rl, false) :: path) (scheduler_paths s2)
+      | Extr.SPos (_, s) -> scheduler_paths s in
+    let paths = List.map Array.of_list (scheduler_paths scheduler) in
+    let rule_conditions = Hashtbl.create 16 in
+    let conditions rl =
+      match Hashtbl.find_opt rule_conditions rl with
+      | Some conds -> conds
+      | None ->
+         let conds = commit_conditions (annotated_rules rl) in
+         Hashtbl.add rule_conditions rl conds;
+         conds in
+
+    (* Registers that must stay checked for exclusions to hold *)
+    let pinned = ref [] in
+    let writes_before path j reg =
+      let rec loop k =
+        k < j &&
+          (let rl, commits = path.(k) in
+           let { Extr.hw0; Extr.hw1; _ } = committed_history rl reg in
+           (commits && not (never hw0 && never hw1)) || loop (k + 1)) in
+      loop 0 in
+    let exclusive path i j =
+      let incompatible (r1, v1, eq1) (r2, v2, eq2) =
+        r1 = r2 &&
+          (if eq1 && eq2 then v1 <> v2 else eq1 <> eq2 && v1 = v2) in
+      let stable reg =
+        if not (writes_before path j reg) then true
+        else if register_kinds reg <> Extr.Value then
+          (if not (List.mem reg !pinned) then pinned := reg :: !pinned; true)
+        else false in
+      let conds_i = conditions (fst path.(i)) in
+      List.exists (fun ((reg, _, _) as c2) ->
+          List.exists (incompatible c2) conds_i && stable reg)
+        (conditions (fst path.(j))) in
+
+    (* Like [append_cf], with [prev] the log of a single earlier rule *)
+    let compatible (prev: Extr.register_history) (h: Extr.register_history) =
+      (never h.Extr.hr0 || (never prev.Extr.hw0 && never prev.Extr.hw1)) &&
+        (never h.Extr.hw0 ||
+           (never prev.Extr.hr1 && never prev.Extr.hw0 && never prev.Extr.hw1)) &&
+        (never h.Extr.hr1 || never prev.Extr.hw1) &&
+        (never h.Extr.hw1 || never prev.Extr.hw1) in
+    let conflict_free reg =
+      List.for_all (fun path ->
+          let ok = ref true in
+          Array.iteri (fun j (rl_j, _) ->
+              let h = reg_histories rl_j reg in
+              ok := !ok && h.Extr.hcf = Extr.TTrue;
+              for i = 0 to j - 1 do
+                let rl_i, commits = path.(i) in
+                if !ok && commits then
+                  let prev = committed_history rl_i reg in
+                  ok := compatible prev h || exclusive path i j
+              done)
+            path;
+          !ok)
+        paths in
+
+    let values =
+      List.filter (fun reg ->
+          register_kinds reg <> Extr.Value && conflict_free reg)
+        registers in
+    let values = List.filter (fun reg -> not (List.mem reg !pinned)) values in
+    fun reg ->
+      if List.mem reg values then Extr.Value
+      else register_kinds reg
+
   let compute_register_histories (type reg_t fn_name_t rule_name_t)
         (_R: reg_t -> extr_type)
         (registers: reg_t list)
@@ -281,9 +678,16 @@ module Util = struct
     let rlEnv = contextEnv rule_names in
     let (reg_histories, annotated_rules), classified_registers =
       Extr.compute_register_histories _R rEnv rlEnv rules scheduler in
-    ((fun (rl: rule_name_t) (r: reg_t) -> Extr.getenv rEnv (Extr.getenv rlEnv reg_histories rl) r),
-     (fun (rl: rule_name_t) -> Extr.getenv rlEnv annotated_rules rl),
-     (fun (r: reg_t) -> Extr.getenv rEnv classified_registers r))
+    let reg_histories (rl: rule_name_t) (r: reg_t) =
+      Extr.getenv rEnv (Extr.getenv rlEnv reg_histories rl) r in
+    let annotated_rules (rl: rule_name_t) =
+      Extr.getenv rlEnv annotated_rules rl in
+    let register_kinds (r: reg_t) =
+      Extr.getenv rEnv classified_registers r in
+    (reg_histories,
+     annotated_rules,
+     refine_register_kinds registers reg_histories annotated_rules
+       register_kinds scheduler)
 
   let may_fail_without_revert registers histories =
     Extr.may_fail_without_revert (contextEnv registers) histories
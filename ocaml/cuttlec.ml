@@ -7,7 +7,7 @@ type frontend =
   CoqPkg | LV | ExtractedML
 
 type backend =
-  [`Coq | `Verilator | `Makefile | `Verilog | `Dot | `Hpp | `Cpp | `Opt]
+  [`Coq | `Verilator | `Makefile | `Verilog | `Dot | `Bitsliced | `Hpp | `Cpp | `Opt]
 
 let all_backends (f: frontend) : backend list =
   let shared = [`Verilator; `Makefile; `Verilog; `Dot; `Hpp; `Cpp] in
@@ -22,7 +22,8 @@ let backends : (backend * (string * string)) list =
    (`Opt, ("opt", ".opt"));
    (`Coq, ("coq", "_coq.v"));
    (`Verilog, ("verilog", "_verilog.v"));
-   (`Verilator, ("verilator", "verilator.cpp"))]
+   (`Verilator, ("verilator", "verilator.cpp"));
+   (`Bitsliced, ("bitsliced", ".bitsliced.hpp"))]
 
 let name_of_backend backend =
   match backend with
@@ -93,11 +94,12 @@ let run_backend' (backend: backend) cnf pkg =
   | (`Hpp | `Cpp | `Opt) as kd ->
      let cpp = Lazy.force pkg.pkg_cpp in
      Backends.Cpp.write_output cnf.cnf_dst_dpath kd cpp
-  | (`Verilog | `Dot) as backend ->
+  | (`Verilog | `Dot | `Bitsliced) as backend ->
      let graph = Lazy.force pkg.pkg_graph in
      match backend with
      | `Dot -> Backends.Rtl.Dot.main cnf.cnf_dst_dpath pkg.pkg_modname graph
      | `Verilog -> Backends.Rtl.main cnf.cnf_dst_dpath pkg.pkg_modname graph
+     | `Bitsliced -> Backends.Bitsliced.main cnf.cnf_dst_dpath pkg.pkg_modname graph
 
 let pstderr fmt =
   Printf.kfprintf (fun out -> fprintf out "\n") stderr fmt
@@ -0,0 +1,63 @@
+(*! Copy propagation and common subexpression elimination in the C++ backend !*)
+Require Import Koika.Frontend.
+
+Inductive reg_t := instr | out.
+Inductive rule_name_t := rl0.
+
+Definition R reg : type :=
+  match reg with
+  | instr => bits_t 32
+  | out => bits_t 8
+  end.
+
+Definition r reg : R reg :=
+  match reg with
+  | instr => Bits.of_nat 32 51
+  | out => Bits.zero
+  end.
+
+(* ‘opcode'’ repeats the expression bound to ‘opcode’ *)
+Definition decode : UInternalFunction reg_t empty_ext_fn_t :=
+  {{ fun decode (inst: bits_t 32) : bits_t 8 =>
+       let opcode := inst[|5`d0| :+ 7] in
+       let funct3 := inst[|5`d12| :+ 3] in
+       let opcode' := inst[|5`d0| :+ 7] in
+       let is_op := opcode' == Ob~0~1~1~0~0~1~1 in
+       if is_op then (Ob~0~0~0~0~0 ++ funct3) else (Ob~0 ++ opcode) }}.
+
+(* ‘copy’ and ‘zero’ are replaced by ‘inst’ and ‘32'd0’ *)
+Definition urules rl : uaction reg_t empty_ext_fn_t :=
+  match rl with
+  | rl0 => {{ let inst := read0(instr) in
+             let copy := inst in
+             let zero := |32`d0| in
+             write0(out, decode(copy ^ zero)) }}
+  end.
+
+Definition rules :=
+  tc_rules R empty_Sigma urules.
+
+Definition sched : scheduler :=
+  rl0 |> done.
+
+Definition sched_result :=
+  tc_compute (interp_scheduler (ContextEnv.(create) r) empty_sigma rules sched).
+
+Definition external (r: rule_name_t) := false.
+
+Definition package :=
+  {| ip_koika := {| koika_reg_types := R;
+                   koika_reg_init := r;
+                   koika_ext_fn_types := empty_Sigma;
+                   koika_rules := rules;
+                   koika_rule_external := external;
+                   koika_scheduler := sched;
+                   koika_module_name := "copy_propagation" |};
+
+     ip_sim := {| sp_ext_fn_specs := empty_ext_fn_props;
+                 sp_prelude := None |};
+
+     ip_verilog := {| vp_ext_fn_specs := empty_ext_fn_props |} |}.
+
+Definition prog := Interop.Backends.register package.
+Extraction "copy_propagation.ml" prog.
@@ -0,0 +1,57 @@
+(*! Dead let-binding elimination in the C++ backend !*)
+Require Import Koika.Frontend.
+
+Inductive reg_t := r0 | r1.
+Inductive rule_name_t := assigned_unread | assigned_read | unused.
+
+Definition R reg : type :=
+  match reg with
+  | r0 => bits_t 32
+  | r1 => bits_t 32
+  end.
+
+Definition r reg : R reg :=
+  match reg with
+  | r0 => Bits.of_nat 32 5
+  | r1 => Bits.zero
+  end.
+
+(* A binding that is only assigned to must still be declared *)
+Definition urules rl : uaction reg_t empty_ext_fn_t :=
+  match rl with
+  | assigned_unread =>
+    {{ let x := |32`d0| in
+       set x := read0(r0) }}
+  | assigned_read =>
+    {{ let x := |32`d0| in
+       set x := read0(r0);
+       write0(r1, x) }}
+  | unused =>
+    {{ let y := |32`d1| in
+       pass }}
+  end.
+
+Definition rules :=
+  tc_rules R empty_Sigma urules.
+
+Definition sched : scheduler :=
+  assigned_unread |> assigned_read |> unused |> done.
+
+Definition external (r: rule_name_t) := false.
+
+Definition package :=
+  {| ip_koika := {| koika_reg_types := R;
+                   koika_reg_init := r;
+                   koika_ext_fn_types := empty_Sigma;
+                   koika_rules := rules;
+                   koika_rule_external := external;
+                   koika_scheduler := sched;
+                   koika_module_name := "dead_bindings" |};
+
+     ip_sim := {| sp_ext_fn_specs := empty_ext_fn_props;
+                 sp_prelude := None |};
+
+     ip_verilog := {| vp_ext_fn_specs := empty_ext_fn_props |} |}.
+
+Definition prog := Interop.Backends.register package.
+Extraction "dead_bindings.ml" prog.
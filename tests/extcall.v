@@ -50,7 +50,8 @@ Definition sched_circuits_result :=
 Definition cpp_ext_fn_specs fn :=
   match fn with
   | f0 => {| efs_name := "cpp_f0";
-            efs_method := false |}
+            efs_method := false;
+            efs_pure := false |}
   end.
 Definition verilog_ext_fn_specs fn :=
   match fn with
@@ -0,0 +1,94 @@
+(*! Register kinds of rules guarded by mutually exclusive conditions !*)
+Require Import Koika.Frontend.
+
+Inductive reg_t := st0 | st1 | st2 | out0 | out1 | out2.
+Inductive ext_fn_t := f0.
+Inductive rule_name_t :=
+| excl_s0 | excl_s1
+| st_wr | pinned_s0 | pinned_s1
+| call_s0 | call_s1.
+
+Definition R reg : type :=
+  match reg with
+  | st0 | st1 | st2 => bits_t 2
+  | out0 | out1 | out2 => bits_t 8
+  end.
+
+Definition r reg : R reg :=
+  match reg with
+  | st0 | st1 | st2 => Bits.zero
+  | out0 | out1 | out2 => Bits.zero
+  end.
+
+Definition Sigma fn : ExternalSignature :=
+  match fn with
+  | f0 => {$ bits_t 2 ~> bits_t 8 $}
+  end.
+
+Definition sigma fn : Sig_denote (Sigma fn) :=
+  match fn with
+  | f0 => fun (bs: bits 2) => Bits.zero
+  end.
+
+Definition urules rl : uaction reg_t ext_fn_t :=
+  match rl with
+  (* ‘excl_s0’ and ‘excl_s1’ cannot both commit, so ‘out0’ is a value *)
+  | excl_s0 => {{ guard(read0(st0) == |2`d0|); write0(out0, |8`d1|) }}
+  | excl_s1 => {{ guard(read0(st0) == |2`d1|); write0(out0, |8`d2|) }}
+  (* ‘st1’ is written before the guards that read it, so it must stay checked
+     for ‘read0(st1)’ to return its initial value (or fail) *)
+  | st_wr => {{ write0(st1, |2`d1|) }}
+  | pinned_s0 => {{ guard(read0(st1) == |2`d0|); write0(out1, |8`d1|) }}
+  | pinned_s1 => {{ guard(read0(st1) == |2`d1|); write0(out1, |8`d2|) }}
+  (* The guard of ‘call_s1’ comes after an external call, so it does not
+     exclude ‘call_s0’ and ‘out2’ stays checked *)
+  | call_s0 => {{ guard(read0(st2) == |2`d0|); write0(out2, |8`d1|) }}
+  | call_s1 => {{ let v := extcall f0(read0(st2)) in
+                 guard(read0(st2) == |2`d1|);
+                 write0(out2, v) }}
+  end.
+
+Definition rules :=
+  tc_rules R Sigma urules.
+
+Definition sched : scheduler :=
+  excl_s0 |> excl_s1 |> st_wr |> pinned_s0 |> pinned_s1 |> call_s0 |> call_s1 |> done.
+
+Definition sched_result :=
+  tc_compute (interp_scheduler (ContextEnv.(create) r) sigma rules sched).
+
+Definition external (r: rule_name_t) := false.
+
+Definition cpp_ext_fn_specs fn :=
+  match fn with
+  | f0 => {| efs_name := "cpp_f0";
+            efs_method := false;
+            efs_pure := false |}
+  end.
+Definition verilog_ext_fn_specs fn :=
+  match fn with
+  | f0 => {| efr_name := "verilog_f0";
+            efr_internal := true |}
+  end.
+
+Definition package :=
+  {| ip_koika := {| koika_reg_types := R;
+                   koika_reg_init := r;
+                   koika_ext_fn_types := Sigma;
+                   koika_rules := rules;
+                   koika_rule_external := external;
+                   koika_scheduler := sched;
+                   koika_module_name := "guard_exclusion" |};
+
+     ip_sim := {| sp_ext_fn_specs := cpp_ext_fn_specs;
+                 sp_prelude := Some "class extfuns {
+public:
+  bits<8> cpp_f0(const bits<2> arg) {
+    return prims::zextl<8>(arg);
+  }
+};" |};
+
+     ip_verilog := {| vp_ext_fn_specs := verilog_ext_fn_specs |} |}.
+
+Definition prog := Interop.Backends.register package.
+Extraction "guard_exclusion.ml" prog.
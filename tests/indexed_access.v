@@ -0,0 +1,76 @@
+(*! Switches over unchecked register files compile to indexed accesses !*)
+Require Import Koika.Frontend.
+Require Import Koika.Std.
+
+Definition data_sz := 8.
+Definition data_tau := bits_t data_sz.
+Definition idx_sz := 2.
+
+Module Rf4_sig <: RfPow2_sig.
+  Definition idx_sz := idx_sz.
+  Definition T := data_tau.
+  Definition init := Bits.zeroes data_sz.
+  Definition read_style := @NestedSwitch var_t.
+  Definition write_style := @NestedSwitch var_t.
+End Rf4_sig.
+
+Module Rf4 := RfPow2 Rf4_sig.
+
+Inductive reg_t := ptr | rf (idx: Rf4.reg_t).
+Inductive rule_name_t := bump.
+
+Definition R reg : type :=
+  match reg with
+  | ptr => bits_t idx_sz
+  | rf idx => Rf4.R idx
+  end.
+
+Definition r reg : R reg :=
+  match reg with
+  | ptr => Bits.zero
+  | rf idx => Rf4.r idx
+  end.
+
+(* A single rule reads and writes ‘rf’ on port 0, so its registers need no
+   read-write set checks and both switches become ‘READ0_…_AT’ and
+   ‘WRITE0_…_AT’ lookups in a table of pointers to members. *)
+Definition _bump : uaction reg_t empty_ext_fn_t :=
+  {{ let idx := read0(ptr) in
+     let v := rf.(Rf4.read_0)(idx) in
+     rf.(Rf4.write_0)(idx, v + |8`d1|);
+     write0(ptr, idx + |2`d1|) }}.
+
+Definition urules rl : uaction reg_t empty_ext_fn_t :=
+  match rl with
+  | bump => _bump
+  end.
+
+Definition rules :=
+  tc_rules R empty_Sigma urules.
+
+Definition sched : scheduler :=
+  bump |> done.
+
+Instance FiniteType_Rf4_reg_t : FiniteType Rf4.reg_t := _.
+
+Definition sched_result :=
+  tc_compute (interp_scheduler (ContextEnv.(create) r) empty_sigma rules sched).
+
+Definition external (r: rule_name_t) := false.
+
+Definition package :=
+  {| ip_koika := {| koika_reg_types := R;
+                   koika_reg_init := r;
+                   koika_ext_fn_types := empty_Sigma;
+                   koika_rules := rules;
+                   koika_rule_external := external;
+                   koika_scheduler := sched;
+                   koika_module_name := "indexed_access" |};
+
+     ip_sim := {| sp_ext_fn_specs := empty_ext_fn_props;
+                 sp_prelude := None |};
+
+     ip_verilog := {| vp_ext_fn_specs := empty_ext_fn_props |} |}.
+
+Definition prog := Interop.Backends.register package.
+Extraction "indexed_access.ml" prog.
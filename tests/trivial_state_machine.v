@@ -59,7 +59,8 @@ Definition package :=
                    koika_module_name := "trivial_state_machine" |};
 
      ip_sim := {| sp_ext_fn_specs fn := {| efs_name := show fn;
-                                         efs_method := false |};
+                                         efs_method := false;
+                                         efs_pure := false |};
                  sp_prelude := Some "class extfuns {
 public:
   bits<32> extA(const bits<32> arg) {